@@ -7,35 +7,810 @@
 #include <linux/uaccess.h>
 #include <linux/device.h>
 #include <linux/cdev.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/mutex.h>
+#include <linux/wait.h>
+#include <linux/log2.h>
+#include <linux/uio.h>
+#include <linux/splice.h>
+#include <linux/string.h>
+#include <linux/overflow.h>
+#include <linux/dma-buf.h>
+#include <linux/dma-mapping.h>
+#include <linux/scatterlist.h>
+#include <linux/version.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,7,0)
+#include <linux/io_uring/cmd.h>
+#define LED_HAVE_URING_CMD
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(5,19,0)
+#include <linux/io_uring.h>
+#define LED_HAVE_URING_CMD
+#endif
+
+/*
+ * splice()/sendfile() go straight through read_iter/write_iter, so data
+ * moves between the ring and pipe pages without a user bounce buffer.
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,5,0)
+#define led_splice_read copy_splice_read
+#else
+#define led_splice_read generic_file_splice_read
+#endif
+
+/* vm_flags became read-only in 6.3, class_create() lost its owner in 6.4 */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,3,0)
+#define led_vm_flags_set(vma, flags) vm_flags_set(vma, flags)
+#else
+#define led_vm_flags_set(vma, flags) ((vma)->vm_flags |= (flags))
+#endif
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,4,0)
+#define led_class_create(name) class_create(name)
+#else
+#define led_class_create(name) class_create(THIS_MODULE, name)
+#endif
+
+#include "chardriver.h"
+#include "../evtrace/evtrace.h"
 
 static struct cdev c_dev;
 static struct class *led_class;
 static dev_t dev_number;
 #define DEVICE_NAME "led"
 
+/*
+ * Size of the ring's data area in bytes, rounded up to a power of two
+ * number of pages. With hugepage=1 the data area is one physically
+ * contiguous high-order allocation instead of vmalloc'ed pages.
+ */
+static unsigned int ring_size = 64 * 1024;
+module_param(ring_size, uint, 0444);
+
+static bool hugepage;
+module_param(hugepage, bool, 0444);
+
+/*
+ * nr_devs independent devices /dev/led0 .. /dev/led<nr_devs - 1>
+ * (plain /dev/led when there is only one). percpu=1 instead creates a
+ * single /dev/led backed by one ring per possible CPU.
+ */
+static unsigned int nr_devs = 1;
+module_param(nr_devs, uint, 0444);
+
+static bool percpu;
+module_param(percpu, bool, 0444);
+
+struct led_ring {
+	struct led_ring_ctrl *ctrl;	/* shared with userspace */
+	char *data;
+	struct page *pages;		/* hugepage backing only */
+	u32 size;
+	struct mutex rlock;		/* serializes read() callers */
+	struct mutex wlock;		/* serializes write() callers */
+	wait_queue_head_t wq;
+};
+
+static struct led_ring *led_rings;
+static unsigned int led_nrings;	/* rings allocated */
+static unsigned int led_nnodes;	/* minors registered */
+
+/* Bytes currently queued between the two free-running indices */
+static inline u32 led_ring_used(u32 head, u32 tail)
+{
+	return head - tail;
+}
+
+static int led_ring_alloc(struct led_ring *r)
+{
+	unsigned int size = roundup_pow_of_two(max_t(unsigned int, ring_size, PAGE_SIZE));
+
+	r->ctrl = (struct led_ring_ctrl *)get_zeroed_page(GFP_KERNEL);
+	if (!r->ctrl)
+		return -ENOMEM;
+
+	if (hugepage) {
+		r->pages = alloc_pages(GFP_KERNEL | __GFP_ZERO | __GFP_COMP |
+				       __GFP_NOWARN, get_order(size));
+		if (r->pages)
+			r->data = page_address(r->pages);
+		else
+			printk(KERN_NOTICE "led: no contiguous memory, falling back to vmalloc\n");
+	}
+	if (!r->data)
+		r->data = vmalloc_user(size);
+	if (!r->data) {
+		free_page((unsigned long)r->ctrl);
+		return -ENOMEM;
+	}
+
+	r->size = size;
+	r->ctrl->size = size;
+	r->ctrl->data_offset = PAGE_SIZE;
+	r->ctrl->flags = r->pages ? LED_RING_HUGEPAGE : 0;
+	mutex_init(&r->rlock);
+	mutex_init(&r->wlock);
+	init_waitqueue_head(&r->wq);
+	return 0;
+}
+
+static void led_ring_free(struct led_ring *r)
+{
+	if (r->pages)
+		__free_pages(r->pages, get_order(r->size));
+	else
+		vfree(r->data);
+	free_page((unsigned long)r->ctrl);
+}
 
+/*
+ * Each minor has its own ring. In percpu mode there is a single node
+ * and an opener is bound to the ring of the CPU it opened it on, so
+ * producers spread over CPUs never share a ring or its locks.
+ */
 static int my_open(struct inode *i, struct file *f)
 {
-	printk(KERN_INFO "Driver: Open()\n");
+	unsigned int idx = percpu ? raw_smp_processor_id() : iminor(i) - MINOR(dev_number);
+
+	evtrace("Driver: Open()\n");
+	if (idx >= led_nrings)
+		return -ENODEV;
+	f->private_data = &led_rings[idx];
+	f->f_mode |= FMODE_NOWAIT;	/* read/write_iter honour IOCB_NOWAIT */
 	return 0;
 }
 
 static int my_close(struct inode *i, struct file *f)
 {
-	printk(KERN_INFO "Driver: close()\n");
+	evtrace("Driver: close()\n");
+	return 0;
+}
+
+static inline bool led_nowait(struct kiocb *iocb)
+{
+	return (iocb->ki_filp->f_flags & O_NONBLOCK) ||
+	       (iocb->ki_flags & IOCB_NOWAIT);
+}
+
+static int led_lock(struct mutex *lock, bool nowait)
+{
+	if (nowait)
+		return mutex_trylock(lock) ? 0 : -EAGAIN;
+	return mutex_lock_interruptible(lock) ? -ERESTARTSYS : 0;
+}
+
+/*
+ * Both directions go through an iov_iter, so readv/writev, preadv2 with
+ * RWF_NOWAIT and io_uring move any number of user buffers in one call.
+ */
+static ssize_t my_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct led_ring *r = iocb->ki_filp->private_data;
+	struct led_ring_ctrl *ctrl = r->ctrl;
+	bool nowait = led_nowait(iocb);
+	u32 head, tail, used, pos, chunk;
+	size_t n;
+	int ret;
+
+	if (!iov_iter_count(to))
+		return 0;
+	ret = led_lock(&r->rlock, nowait);
+	if (ret)
+		return ret;
+
+	tail = READ_ONCE(ctrl->tail);
+	while ((head = smp_load_acquire(&ctrl->head)) == tail) {
+		mutex_unlock(&r->rlock);
+		if (nowait)
+			return -EAGAIN;
+		if (wait_event_interruptible(r->wq,
+				smp_load_acquire(&ctrl->head) != READ_ONCE(ctrl->tail)))
+			return -ERESTARTSYS;
+		ret = led_lock(&r->rlock, nowait);
+		if (ret)
+			return ret;
+		tail = READ_ONCE(ctrl->tail);
+	}
+
+	/*
+	 * head and tail can be scribbled on by userspace through the
+	 * mapping, so never trust a fill level larger than the ring.
+	 */
+	used = led_ring_used(head, tail);
+	if (used > r->size) {
+		mutex_unlock(&r->rlock);
+		return -EIO;
+	}
+	used = min_t(size_t, used, iov_iter_count(to));
+	pos = tail & (r->size - 1);
+	chunk = min(used, r->size - pos);
+
+	n = copy_to_iter(r->data + pos, chunk, to);
+	if (n == chunk)
+		n += copy_to_iter(r->data, used - chunk, to);
+	if (!n) {
+		mutex_unlock(&r->rlock);
+		return -EFAULT;
+	}
+	smp_store_release(&ctrl->tail, tail + n);
+	mutex_unlock(&r->rlock);
+
+	wake_up_interruptible(&r->wq);
+	return n;
+}
+
+static inline u32 led_ring_room(struct led_ring *r)
+{
+	return r->size - led_ring_used(READ_ONCE(r->ctrl->head),
+					 smp_load_acquire(&r->ctrl->tail));
+}
+
+/*
+ * Take the write side of the ring once at least @need bytes are free.
+ * On success wlock is held and *head / *room describe the free space;
+ * finish with led_ring_commit() or drop wlock.
+ */
+static int led_ring_reserve(struct led_ring *r, u32 need, bool nowait, u32 *head, u32 *room)
+{
+	struct led_ring_ctrl *ctrl = r->ctrl;
+	u32 tail;
+	int ret;
+
+	ret = led_lock(&r->wlock, nowait);
+	if (ret)
+		return ret;
+
+	for (;;) {
+		*head = READ_ONCE(ctrl->head);
+		tail = smp_load_acquire(&ctrl->tail);
+		if (led_ring_used(*head, tail) > r->size) {
+			mutex_unlock(&r->wlock);
+			return -EIO;
+		}
+		*room = r->size - led_ring_used(*head, tail);
+		if (*room >= need)
+			return 0;
+
+		mutex_unlock(&r->wlock);
+		if (nowait)
+			return -EAGAIN;
+		if (wait_event_interruptible(r->wq, led_ring_room(r) >= need))
+			return -ERESTARTSYS;
+		ret = led_lock(&r->wlock, nowait);
+		if (ret)
+			return ret;
+	}
+}
+
+static void led_ring_commit(struct led_ring *r, u32 head, u32 n)
+{
+	smp_store_release(&r->ctrl->head, head + n);
+	mutex_unlock(&r->wlock);
+	wake_up_interruptible(&r->wq);
+}
+
+/*
+ * Append @len bytes from userspace as one record, or nothing if it
+ * doesn't fit. Caller holds wlock.
+ */
+static int led_ring_put_user(struct led_ring *r, const char __user *ubuf, u32 len)
+{
+	u32 head = READ_ONCE(r->ctrl->head);
+	u32 used = led_ring_used(head, smp_load_acquire(&r->ctrl->tail));
+	u32 pos, chunk;
+
+	if (used > r->size)
+		return -EIO;
+	if (len > r->size - used)
+		return -EAGAIN;
+
+	pos = head & (r->size - 1);
+	chunk = min(len, r->size - pos);
+	if (copy_from_user(r->data + pos, ubuf, chunk) ||
+	    copy_from_user(r->data, ubuf + chunk, len - chunk))
+		return -EFAULT;
+	smp_store_release(&r->ctrl->head, head + len);
+	return len;
+}
+
+/*
+ * Copy up to @len bytes starting @skip bytes past the tail to userspace.
+ * With @consume the skipped and copied bytes are released. Caller holds
+ * rlock.
+ */
+static int led_ring_get_user(struct led_ring *r, char __user *ubuf, u32 len,
+			     u32 skip, bool consume)
+{
+	u32 tail = READ_ONCE(r->ctrl->tail);
+	u32 used = led_ring_used(smp_load_acquire(&r->ctrl->head), tail);
+	u32 pos, chunk;
+
+	if (used > r->size)
+		return -EIO;
+	if (skip >= used)
+		return consume ? -EAGAIN : 0;
+
+	len = min(len, used - skip);
+	pos = (tail + skip) & (r->size - 1);
+	chunk = min(len, r->size - pos);
+	if (copy_to_user(ubuf, r->data + pos, chunk) ||
+	    copy_to_user(ubuf + chunk, r->data, len - chunk))
+		return -EFAULT;
+	if (consume)
+		smp_store_release(&r->ctrl->tail, tail + skip + len);
+	return len;
+}
+
+static ssize_t my_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct led_ring *r = iocb->ki_filp->private_data;
+	u32 head, room, pos, chunk;
+	size_t n;
+	int ret;
+
+	if (!iov_iter_count(from))
+		return 0;
+	ret = led_ring_reserve(r, 1, led_nowait(iocb), &head, &room);
+	if (ret)
+		return ret;
+
+	room = min_t(size_t, room, iov_iter_count(from));
+	pos = head & (r->size - 1);
+	chunk = min(room, r->size - pos);
+
+	n = copy_from_iter(r->data + pos, chunk, from);
+	if (n == chunk)
+		n += copy_from_iter(r->data, room - chunk, from);
+	if (!n) {
+		mutex_unlock(&r->wlock);
+		return -EFAULT;
+	}
+	led_ring_commit(r, head, n);
+	return n;
+}
+
+#ifdef LED_HAVE_URING_CMD
+/*
+ * io_uring passthrough. Commands run inline from the submitting task;
+ * one that would have to sleep returns -EAGAIN under
+ * IO_URING_F_NONBLOCK and io_uring retries it from its worker pool.
+ * Either way the result is posted to the CQ, so userspace can batch
+ * submissions and reap completions without a syscall per command.
+ */
+static int led_uring_submit(struct led_ring *r, const struct led_uring_cmd *cmd,
+			    bool nowait)
+{
+	u32 head, room;
+	int ret;
+
+	if (!cmd->len || cmd->len > r->size)
+		return -EINVAL;
+	/* A record goes in whole or not at all */
+	ret = led_ring_reserve(r, cmd->len, nowait, &head, &room);
+	if (ret)
+		return ret;
+
+	ret = led_ring_put_user(r, u64_to_user_ptr(cmd->addr), cmd->len);
+	mutex_unlock(&r->wlock);
+	if (ret > 0)
+		wake_up_interruptible(&r->wq);
+	return ret;
+}
+
+static int led_uring_query(struct led_ring *r, const struct led_uring_cmd *cmd)
+{
+	struct led_ring_state st;
+
+	st.head = READ_ONCE(r->ctrl->head);
+	st.tail = READ_ONCE(r->ctrl->tail);
+	st.size = r->size;
+	st.flags = r->ctrl->flags;
+	if (cmd->addr && copy_to_user(u64_to_user_ptr(cmd->addr), &st, sizeof(st)))
+		return -EFAULT;
+	return min(led_ring_used(st.head, st.tail), r->size);
+}
+
+static int led_uring_flush(struct led_ring *r, bool nowait)
+{
+	u32 head, used;
+	int ret;
+
+	ret = led_lock(&r->rlock, nowait);
+	if (ret)
+		return ret;
+	head = smp_load_acquire(&r->ctrl->head);
+	used = led_ring_used(head, READ_ONCE(r->ctrl->tail));
+	smp_store_release(&r->ctrl->tail, head);
+	mutex_unlock(&r->rlock);
+
+	wake_up_interruptible(&r->wq);
+	return min(used, r->size);
+}
+
+static int my_uring_cmd(struct io_uring_cmd *ioucmd, unsigned int issue_flags)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,6,0)
+	const struct led_uring_cmd *sqe_cmd = io_uring_sqe_cmd(ioucmd->sqe);
+#else
+	const struct led_uring_cmd *sqe_cmd = ioucmd->cmd;
+#endif
+	struct led_ring *r = ioucmd->file->private_data;
+	bool nowait = issue_flags & IO_URING_F_NONBLOCK;
+	struct led_uring_cmd cmd;
+
+	/* The SQE stays writable by userspace, read it exactly once */
+	cmd.addr = READ_ONCE(sqe_cmd->addr);
+	cmd.len = READ_ONCE(sqe_cmd->len);
+	cmd.flags = READ_ONCE(sqe_cmd->flags);
+
+	switch (ioucmd->cmd_op) {
+	case LED_CMD_SUBMIT:
+		return led_uring_submit(r, &cmd, nowait);
+	case LED_CMD_QUERY:
+		return led_uring_query(r, &cmd);
+	case LED_CMD_FLUSH:
+		return led_uring_flush(r, nowait);
+	default:
+		return -ENOTTY;
+	}
+}
+#endif
+
+/*
+ * Run a whole array of read/write descriptors under a single lock
+ * round trip. Every entry gets its own result; the ioctl returns how
+ * many entries succeeded. Entries never block: a write that doesn't
+ * fit or a read of an empty ring reports -EAGAIN.
+ */
+static long led_ioctl_batch(struct led_ring *r, struct led_batch __user *ubatch)
+{
+	struct led_batch batch;
+	struct led_batch_op *ops;
+	long ret, done = 0;
+	u32 i;
+
+	if (copy_from_user(&batch, ubatch, sizeof(batch)))
+		return -EFAULT;
+	if (!batch.nr || batch.nr > LED_BATCH_MAX)
+		return -EINVAL;
+
+	ops = memdup_user(u64_to_user_ptr(batch.ops),
+			  array_size(batch.nr, sizeof(*ops)));
+	if (IS_ERR(ops))
+		return PTR_ERR(ops);
+	for (i = 0; i < batch.nr; i++)
+		ops[i].result = -ECANCELED;
+
+	if (mutex_lock_interruptible(&r->wlock)) {
+		ret = -ERESTARTSYS;
+		goto out;
+	}
+	if (mutex_lock_interruptible(&r->rlock)) {
+		mutex_unlock(&r->wlock);
+		ret = -ERESTARTSYS;
+		goto out;
+	}
+
+	for (i = 0; i < batch.nr; i++) {
+		struct led_batch_op *op = &ops[i];
+		void __user *ubuf = u64_to_user_ptr(op->addr);
+		u32 skip = min_t(u64, op->offset, U32_MAX);
+
+		switch (op->flags & LED_OP_MASK) {
+		case LED_OP_WRITE:
+			op->result = op->offset ? -EINVAL :
+				     led_ring_put_user(r, ubuf, op->len);
+			break;
+		case LED_OP_READ:
+			op->result = led_ring_get_user(r, ubuf, op->len, skip, true);
+			break;
+		case LED_OP_PEEK:
+			op->result = led_ring_get_user(r, ubuf, op->len, skip, false);
+			break;
+		default:
+			op->result = -EINVAL;
+			break;
+		}
+		if (op->result >= 0)
+			done++;
+		else if (batch.flags & LED_BATCH_STOP_ON_ERROR)
+			break;
+	}
+
+	mutex_unlock(&r->rlock);
+	mutex_unlock(&r->wlock);
+	wake_up_interruptible(&r->wq);
+
+	if (copy_to_user(u64_to_user_ptr(batch.ops), ops,
+			 array_size(batch.nr, sizeof(*ops))))
+		ret = -EFAULT;
+	else
+		ret = done;
+out:
+	kfree(ops);
+	return ret;
+}
+
+static long led_ioctl_export(struct file *f,
+			     struct led_dmabuf_export __user *uarg);
+
+static long my_ioctl(struct file *f, unsigned int cmd, unsigned long arg)
+{
+	struct led_ring *r = f->private_data;
+
+	switch (cmd) {
+	case LED_IOC_BATCH:
+		return led_ioctl_batch(r, (struct led_batch __user *)arg);
+	case LED_IOC_EXPORT_DMABUF:
+		return led_ioctl_export(f, (struct led_dmabuf_export __user *)arg);
+	default:
+		return -ENOTTY;
+	}
+}
+
+static struct page *led_ring_page(struct led_ring *r, unsigned long i)
+{
+	if (r->pages)
+		return nth_page(r->pages, i);
+	return vmalloc_to_page(r->data + i * PAGE_SIZE);
+}
+
+/*
+ * Map the ring's data pages, starting with page @pgoff, from @uaddr to
+ * the end of @vma.
+ */
+static int led_ring_map_data(struct led_ring *r, struct vm_area_struct *vma,
+			     unsigned long uaddr, unsigned long pgoff)
+{
+	unsigned long npages = (vma->vm_end - uaddr) >> PAGE_SHIFT;
+	int ret = 0;
+
+	if (pgoff > (r->size >> PAGE_SHIFT) ||
+	    npages > (r->size >> PAGE_SHIFT) - pgoff)
+		return -EINVAL;
+
+	if (r->pages && npages)
+		return remap_pfn_range(vma, uaddr, page_to_pfn(r->pages) + pgoff,
+				       vma->vm_end - uaddr, vma->vm_page_prot);
+	for (; !ret && uaddr < vma->vm_end; pgoff++, uaddr += PAGE_SIZE)
+		ret = vm_insert_page(vma, uaddr, led_ring_page(r, pgoff));
+	return ret;
+}
+
+/*
+ * Map the control page at offset 0 and the data pages right after it.
+ * Producers and consumers then move data with plain loads and stores.
+ */
+static int my_mmap(struct file *f, struct vm_area_struct *vma)
+{
+	struct led_ring *r = f->private_data;
+	unsigned long len = vma->vm_end - vma->vm_start;
+	int ret;
+
+	if (vma->vm_pgoff != 0 || len > PAGE_SIZE + r->size)
+		return -EINVAL;
+
+	led_vm_flags_set(vma, VM_DONTEXPAND | VM_DONTDUMP);
+
+	if (r->pages)
+		ret = remap_pfn_range(vma, vma->vm_start,
+				      virt_to_phys(r->ctrl) >> PAGE_SHIFT,
+				      PAGE_SIZE, vma->vm_page_prot);
+	else
+		ret = vm_insert_page(vma, vma->vm_start, virt_to_page(r->ctrl));
+	if (ret)
+		return ret;
+	return led_ring_map_data(r, vma, vma->vm_start + PAGE_SIZE, 0);
+}
+
+/*
+ * dma-buf export of a ring's data pages. Other drivers attach and map
+ * the same memory for DMA; userspace can mmap the dma-buf fd. CPU
+ * access must be bracketed with DMA_BUF_IOCTL_SYNC (begin/end), which
+ * syncs the caches of every device currently mapping the buffer.
+ */
+struct led_dmabuf {
+	struct led_ring *ring;
+	struct page **pages;
+	unsigned int npages;
+	struct mutex lock;		/* protects attachments */
+	struct list_head attachments;
+};
+
+struct led_dmabuf_attach {
+	struct list_head node;
+	struct device *dev;
+	struct sg_table sgt;
+	enum dma_data_direction dir;
+	bool mapped;
+};
+
+static int led_dmabuf_attach(struct dma_buf *dmabuf,
+			     struct dma_buf_attachment *attach)
+{
+	struct led_dmabuf *buf = dmabuf->priv;
+	struct led_dmabuf_attach *a;
+	int ret;
+
+	a = kzalloc(sizeof(*a), GFP_KERNEL);
+	if (!a)
+		return -ENOMEM;
+	ret = sg_alloc_table_from_pages(&a->sgt, buf->pages, buf->npages, 0,
+					(size_t)buf->npages << PAGE_SHIFT,
+					GFP_KERNEL);
+	if (ret) {
+		kfree(a);
+		return ret;
+	}
+	a->dev = attach->dev;
+	attach->priv = a;
+
+	mutex_lock(&buf->lock);
+	list_add(&a->node, &buf->attachments);
+	mutex_unlock(&buf->lock);
 	return 0;
 }
 
-static ssize_t my_read(struct file *f, char __user *buf, size_t len, loff_t *off)
+static void led_dmabuf_detach(struct dma_buf *dmabuf,
+			      struct dma_buf_attachment *attach)
+{
+	struct led_dmabuf *buf = dmabuf->priv;
+	struct led_dmabuf_attach *a = attach->priv;
+
+	mutex_lock(&buf->lock);
+	list_del(&a->node);
+	mutex_unlock(&buf->lock);
+	sg_free_table(&a->sgt);
+	kfree(a);
+}
+
+static struct sg_table *led_dmabuf_map(struct dma_buf_attachment *attach,
+				       enum dma_data_direction dir)
 {
-	printk(KERN_INFO "Driver: read()\n");
+	struct led_dmabuf *buf = attach->dmabuf->priv;
+	struct led_dmabuf_attach *a = attach->priv;
+	int ret;
+
+	ret = dma_map_sgtable(attach->dev, &a->sgt, dir, 0);
+	if (ret)
+		return ERR_PTR(ret);
+
+	mutex_lock(&buf->lock);
+	a->dir = dir;
+	a->mapped = true;
+	mutex_unlock(&buf->lock);
+	return &a->sgt;
+}
+
+static void led_dmabuf_unmap(struct dma_buf_attachment *attach,
+			     struct sg_table *sgt, enum dma_data_direction dir)
+{
+	struct led_dmabuf *buf = attach->dmabuf->priv;
+	struct led_dmabuf_attach *a = attach->priv;
+
+	mutex_lock(&buf->lock);
+	a->mapped = false;
+	mutex_unlock(&buf->lock);
+	dma_unmap_sgtable(attach->dev, sgt, dir, 0);
+}
+
+static int led_dmabuf_begin_cpu_access(struct dma_buf *dmabuf,
+				       enum dma_data_direction dir)
+{
+	struct led_dmabuf *buf = dmabuf->priv;
+	struct led_dmabuf_attach *a;
+
+	mutex_lock(&buf->lock);
+	list_for_each_entry(a, &buf->attachments, node)
+		if (a->mapped)
+			dma_sync_sgtable_for_cpu(a->dev, &a->sgt, a->dir);
+	mutex_unlock(&buf->lock);
 	return 0;
 }
 
-static ssize_t my_write(struct file *f, const char __user *buf, size_t len, loff_t *off)
+static int led_dmabuf_end_cpu_access(struct dma_buf *dmabuf,
+				     enum dma_data_direction dir)
+{
+	struct led_dmabuf *buf = dmabuf->priv;
+	struct led_dmabuf_attach *a;
+
+	mutex_lock(&buf->lock);
+	list_for_each_entry(a, &buf->attachments, node)
+		if (a->mapped)
+			dma_sync_sgtable_for_device(a->dev, &a->sgt, a->dir);
+	mutex_unlock(&buf->lock);
+	return 0;
+}
+
+static int led_dmabuf_mmap(struct dma_buf *dmabuf, struct vm_area_struct *vma)
+{
+	struct led_dmabuf *buf = dmabuf->priv;
+
+	led_vm_flags_set(vma, VM_DONTEXPAND | VM_DONTDUMP);
+	return led_ring_map_data(buf->ring, vma, vma->vm_start, vma->vm_pgoff);
+}
+
+static void led_dmabuf_free(struct led_dmabuf *buf)
+{
+	kvfree(buf->pages);
+	kfree(buf);
+}
+
+static void led_dmabuf_release(struct dma_buf *dmabuf)
+{
+	led_dmabuf_free(dmabuf->priv);
+}
+
+static const struct dma_buf_ops led_dmabuf_ops = {
+	.attach = led_dmabuf_attach,
+	.detach = led_dmabuf_detach,
+	.map_dma_buf = led_dmabuf_map,
+	.unmap_dma_buf = led_dmabuf_unmap,
+	.begin_cpu_access = led_dmabuf_begin_cpu_access,
+	.end_cpu_access = led_dmabuf_end_cpu_access,
+	.mmap = led_dmabuf_mmap,
+	.release = led_dmabuf_release,
+};
+
+/*
+ * The exported buffer holds a reference on this module, so the rings
+ * it points into stay around for as long as any fd or importer does.
+ */
+static long led_ioctl_export(struct file *f,
+			     struct led_dmabuf_export __user *uarg)
 {
-	printk(KERN_INFO "Driver: write()\n");
-	return len; 
+	DEFINE_DMA_BUF_EXPORT_INFO(exp_info);
+	struct led_ring *r = f->private_data;
+	struct led_dmabuf_export arg;
+	struct led_dmabuf *buf;
+	struct dma_buf *dmabuf;
+	unsigned int i, acc;
+	int fd;
+
+	if (copy_from_user(&arg, uarg, sizeof(arg)))
+		return -EFAULT;
+	if (arg.flags & ~(O_CLOEXEC | O_ACCMODE))
+		return -EINVAL;
+	acc = arg.flags & O_ACCMODE;
+	if (acc == O_ACCMODE)
+		return -EINVAL;
+	/* No writable window onto the ring through a read-only fd */
+	if (acc != O_RDONLY && !(f->f_mode & FMODE_WRITE))
+		return -EPERM;
+
+	buf = kzalloc(sizeof(*buf), GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+	buf->ring = r;
+	buf->npages = r->size >> PAGE_SHIFT;
+	buf->pages = kvmalloc_array(buf->npages, sizeof(*buf->pages), GFP_KERNEL);
+	if (!buf->pages) {
+		kfree(buf);
+		return -ENOMEM;
+	}
+	for (i = 0; i < buf->npages; i++)
+		buf->pages[i] = led_ring_page(r, i);
+	mutex_init(&buf->lock);
+	INIT_LIST_HEAD(&buf->attachments);
+
+	exp_info.ops = &led_dmabuf_ops;
+	exp_info.size = r->size;
+	exp_info.flags = acc;
+	exp_info.priv = buf;
+	dmabuf = dma_buf_export(&exp_info);
+	if (IS_ERR(dmabuf)) {
+		led_dmabuf_free(buf);
+		return PTR_ERR(dmabuf);
+	}
+
+	fd = dma_buf_fd(dmabuf, arg.flags & O_CLOEXEC);
+	if (fd < 0) {
+		dma_buf_put(dmabuf);	/* releases buf */
+		return fd;
+	}
+	arg.fd = fd;
+	if (copy_to_user(uarg, &arg, sizeof(arg)))
+		return -EFAULT;
+	return 0;
 }
 
 static struct file_operations pugs_fops = 
@@ -43,30 +818,79 @@ static struct file_operations pugs_fops =
 	.owner = THIS_MODULE,
 	.open = my_open, 
 	.release = my_close,
-	.read = my_read, 
-	.write = my_write
+	.read_iter = my_read_iter,
+	.write_iter = my_write_iter,
+	.splice_read = led_splice_read,
+	.splice_write = iter_file_splice_write,
+	.mmap = my_mmap,
+	.unlocked_ioctl = my_ioctl,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,5,0)
+	.compat_ioctl = compat_ptr_ioctl,
+#endif
+#ifdef LED_HAVE_URING_CMD
+	.uring_cmd = my_uring_cmd,
+#endif
 };
+static void led_rings_free(void)
+{
+	unsigned int n;
+
+	for (n = 0; n < led_nrings; n++)
+		led_ring_free(&led_rings[n]);
+	kfree(led_rings);
+}
+
 //Driver Initialization
 int led_init(void){
+	unsigned int n;
+	int ret;
+
+	if (percpu) {
+		led_nrings = nr_cpu_ids;
+		led_nnodes = 1;
+	} else {
+		led_nrings = led_nnodes = max(nr_devs, 1U);
+	}
+
+	led_rings = kcalloc(led_nrings, sizeof(*led_rings), GFP_KERNEL);
+	if (!led_rings)
+		return -ENOMEM;
+	for (n = 0; n < led_nrings; n++) {
+		ret = led_ring_alloc(&led_rings[n]);
+		if (ret) {
+			led_nrings = n;
+			led_rings_free();
+			return ret;
+		}
+	}
+	printk(KERN_INFO "%u ring(s) of %u bytes%s\n", led_nrings,
+	       led_rings[0].size, led_rings[0].pages ? " (contiguous)" : "");
 
 	//Dynamic allocation of the device number
-	if(alloc_chrdev_region(&dev_number, 0,1,DEVICE_NAME) < 0){
+	if(alloc_chrdev_region(&dev_number, 0, led_nnodes, DEVICE_NAME) < 0){
 		printk("can't register new device\n");
+		led_rings_free();
 		return -1;
 	}
 	
 	printk(KERN_INFO "Major = %d Minor = %d\n", MAJOR(dev_number), MINOR(dev_number));
 
 	//Creates class file in /sys/class/Testingsysfsclass
-	led_class=class_create(THIS_MODULE, "TestingSysfsclass");
+	led_class=led_class_create("TestingSysfsclass");
 	printk("the sysfs class is created\n");
 
-	//Creates Device file in /sys/class/Testingsysfsclass/led
-	device_create(led_class, NULL,dev_number, NULL, DEVICE_NAME);
+	//Creates Device file in /sys/class/Testingsysfsclass/led (or led0..N-1)
+	for (n = 0; n < led_nnodes; n++) {
+		if (led_nnodes == 1)
+			device_create(led_class, NULL, dev_number, NULL, DEVICE_NAME);
+		else
+			device_create(led_class, NULL, dev_number + n, NULL,
+				      DEVICE_NAME "%u", n);
+	}
 
 	//map the file operations to the device
 	cdev_init(&c_dev, &pugs_fops);
-	cdev_add(&c_dev, dev_number, 1);
+	cdev_add(&c_dev, dev_number, led_nnodes);
 
 	return 0;
 }
@@ -74,9 +898,14 @@ int led_init(void){
 //Driver exit function
 void led_cleanup(void)
 {
-	device_destroy(led_class,dev_number);
+	unsigned int n;
+
+	cdev_del(&c_dev);
+	for (n = 0; n < led_nnodes; n++)
+		device_destroy(led_class, dev_number + n);
 	class_destroy(led_class);
-	unregister_chrdev_region(dev_number, 1);
+	unregister_chrdev_region(dev_number, led_nnodes);
+	led_rings_free();
 	printk("the sysfs class is destroyed\n");
 	return;
 }
@@ -85,4 +914,6 @@ module_init(led_init);
 module_exit(led_cleanup);
 
 MODULE_LICENSE("GPL v2");
-
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,16,0)
+MODULE_IMPORT_NS(DMA_BUF);
+#endif
@@ -0,0 +1,101 @@
+/*
+ * chardriver.h -- definitions shared by the led driver and userspace
+ */
+
+#ifndef _CHARDRIVER_H
+#define _CHARDRIVER_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * The mmap area of /dev/led is one control page followed by the ring's
+ * data pages. head is only advanced by the producer and tail only by the
+ * consumer; both are free-running byte counters, so the fill level is
+ * head - tail and a position in the data area is (index & (size - 1)).
+ * Producers publish data with a release store to head, consumers free
+ * space with a release store to tail. head and tail live on separate
+ * cache lines so the two sides don't bounce one line between them.
+ */
+struct led_ring_ctrl {
+	__u32 head;
+	__u32 __pad0[15];
+	__u32 tail;
+	__u32 __pad1[15];
+	__u32 size;		/* bytes in the data area, a power of two */
+	__u32 data_offset;	/* mmap offset of the data area */
+	__u32 flags;
+};
+
+#define LED_RING_HUGEPAGE	0x0001	/* data area is physically contiguous */
+
+/*
+ * io_uring passthrough (IORING_OP_URING_CMD). sqe->cmd_op is one of the
+ * LED_CMD_* values and the SQE's command area holds a struct
+ * led_uring_cmd. The CQE result is the record length for SUBMIT, the
+ * number of unread bytes for QUERY and the number discarded for FLUSH.
+ */
+#define LED_CMD_SUBMIT	1	/* append len bytes at addr as one record */
+#define LED_CMD_QUERY	2	/* fill a struct led_ring_state at addr, if set */
+#define LED_CMD_FLUSH	3	/* drop everything not yet consumed */
+
+struct led_uring_cmd {
+	__u64 addr;
+	__u32 len;
+	__u32 flags;
+};
+
+struct led_ring_state {
+	__u32 head;
+	__u32 tail;
+	__u32 size;
+	__u32 flags;
+};
+
+/*
+ * Batched ioctl. ops points to an array of nr descriptors; each one is
+ * executed in order and its result (bytes moved or -errno) written
+ * back. Writes append len bytes at addr as one record and need offset
+ * 0. Reads consume offset bytes and then copy out up to len; peeks do
+ * the same without consuming anything.
+ */
+#define LED_OP_WRITE	1
+#define LED_OP_READ	2
+#define LED_OP_PEEK	3
+#define LED_OP_MASK	0xff
+
+struct led_batch_op {
+	__u64 offset;
+	__u64 addr;
+	__u32 len;
+	__u32 flags;
+	__s32 result;
+	__u32 __pad;
+};
+
+#define LED_BATCH_STOP_ON_ERROR	0x0001	/* leave the rest at -ECANCELED */
+#define LED_BATCH_MAX		1024
+
+struct led_batch {
+	__u64 ops;
+	__u32 nr;
+	__u32 flags;
+};
+
+#define LED_IOC_MAGIC	'l'
+#define LED_IOC_BATCH	_IOWR(LED_IOC_MAGIC, 1, struct led_batch)
+
+/*
+ * Export the ring's data pages (not the control page) as a dma-buf.
+ * flags takes O_CLOEXEC and an access mode, O_RDONLY, O_WRONLY or
+ * O_RDWR; a writable export needs the device open for writing. The new
+ * fd is returned in fd.
+ */
+struct led_dmabuf_export {
+	__u32 flags;
+	__s32 fd;
+};
+
+#define LED_IOC_EXPORT_DMABUF	_IOWR(LED_IOC_MAGIC, 2, struct led_dmabuf_export)
+
+#endif /* _CHARDRIVER_H */
@@ -0,0 +1,254 @@
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/percpu.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/log2.h>
+#include <linux/sched/clock.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/uaccess.h>
+
+#include "evtrace.h"
+
+MODULE_LICENSE("Dual BSD/GPL");
+
+/*
+ * A flight recorder for driver callbacks, to be used instead of printk
+ * on hot paths. Every CPU has its own ring of fixed-size entries and
+ * only ever writes to it with local interrupts off, so logging takes
+ * no lock and shares no cache line with other CPUs; when the ring is
+ * full the oldest entries are overwritten. Readers are lock-free too:
+ * each entry carries a sequence count that is odd while it is being
+ * written, and a copy is only printed if the count didn't move.
+ *
+ * Tracing is gated by a static key, off by default:
+ *
+ *	echo 1 > /sys/kernel/debug/evtrace/enable
+ *	cat /sys/kernel/debug/evtrace/trace
+ *
+ * Writing anything to trace discards what has been logged so far.
+ */
+
+#define EVTRACE_MSG	112
+
+struct evtrace_entry {
+	unsigned int seq;
+	unsigned int len;
+	u64 ts;
+	char msg[EVTRACE_MSG];
+};
+
+struct evtrace_cpu {
+	struct evtrace_entry *ring;
+	unsigned long head;		/* entries ever written */
+	unsigned long tail;		/* first entry not cleared */
+};
+
+static unsigned int entries = 1024;	/* per CPU, rounded up to a power of two */
+module_param(entries, uint, 0444);
+
+static bool enable;
+module_param(enable, bool, 0444);
+
+DEFINE_STATIC_KEY_FALSE(evtrace_key);
+EXPORT_SYMBOL_GPL(evtrace_key);
+
+static DEFINE_PER_CPU(struct evtrace_cpu, evtrace_cpus);
+static unsigned long evtrace_mask;
+static struct dentry *evtrace_dir;
+
+void __evtrace(const char *fmt, ...)
+{
+	struct evtrace_cpu *c;
+	struct evtrace_entry *e;
+	unsigned long flags;
+	va_list args;
+
+	local_irq_save(flags);
+	c = this_cpu_ptr(&evtrace_cpus);
+	e = &c->ring[c->head & evtrace_mask];
+
+	WRITE_ONCE(e->seq, e->seq + 1);
+	smp_wmb();
+	e->ts = local_clock();
+	va_start(args, fmt);
+	e->len = vscnprintf(e->msg, sizeof(e->msg), fmt, args);
+	va_end(args);
+	smp_wmb();
+	WRITE_ONCE(e->seq, e->seq + 1);
+	WRITE_ONCE(c->head, c->head + 1);
+	local_irq_restore(flags);
+}
+EXPORT_SYMBOL_GPL(__evtrace);
+
+/* The seq_file position is a CPU number; each show prints one ring */
+static void *trace_start(struct seq_file *m, loff_t *pos)
+{
+	unsigned int cpu = *pos;
+
+	if (cpu >= nr_cpu_ids)
+		return NULL;
+	cpu = cpumask_next((int)cpu - 1, cpu_possible_mask);
+	if (cpu >= nr_cpu_ids)
+		return NULL;
+	*pos = cpu;
+	return per_cpu_ptr(&evtrace_cpus, cpu);
+}
+
+static void *trace_next(struct seq_file *m, void *v, loff_t *pos)
+{
+	++*pos;
+	return trace_start(m, pos);
+}
+
+static void trace_stop(struct seq_file *m, void *v)
+{
+}
+
+static int trace_show(struct seq_file *m, void *v)
+{
+	struct evtrace_cpu *c = v;
+	struct evtrace_entry copy, *e;
+	unsigned long head, i;
+	unsigned int seq, len;
+
+	head = READ_ONCE(c->head);
+	smp_rmb();
+	i = READ_ONCE(c->tail);
+	if (head - i > evtrace_mask + 1)
+		i = head - (evtrace_mask + 1);
+
+	for (; i != head; i++) {
+		e = &c->ring[i & evtrace_mask];
+		seq = READ_ONCE(e->seq);
+		if (seq & 1)
+			continue;
+		smp_rmb();
+		copy = *e;
+		smp_rmb();
+		/* Rewritten while we copied, or lapped before we got here */
+		if (READ_ONCE(e->seq) != seq ||
+		    READ_ONCE(c->head) - i > evtrace_mask + 1)
+			continue;
+		/* Callers may or may not end their messages with a newline */
+		len = min_t(unsigned int, copy.len, EVTRACE_MSG);
+		if (len && copy.msg[len - 1] == '\n')
+			len--;
+		seq_printf(m, "[%03lld] %llu.%06llu %.*s\n", (long long)m->index,
+			   copy.ts / NSEC_PER_SEC, (copy.ts % NSEC_PER_SEC) / 1000,
+			   len, copy.msg);
+	}
+	return 0;
+}
+
+static const struct seq_operations trace_sops = {
+	.start	= trace_start,
+	.next	= trace_next,
+	.stop	= trace_stop,
+	.show	= trace_show,
+};
+
+static int trace_open(struct inode *inode, struct file *file)
+{
+	return seq_open(file, &trace_sops);
+}
+
+static ssize_t trace_write(struct file *file, const char __user *buf,
+			   size_t count, loff_t *ppos)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct evtrace_cpu *c = per_cpu_ptr(&evtrace_cpus, cpu);
+
+		WRITE_ONCE(c->tail, READ_ONCE(c->head));
+	}
+	return count;
+}
+
+static const struct file_operations trace_fops = {
+	.owner		= THIS_MODULE,
+	.open		= trace_open,
+	.read		= seq_read,
+	.write		= trace_write,
+	.llseek		= seq_lseek,
+	.release	= seq_release,
+};
+
+static ssize_t enable_read(struct file *file, char __user *buf, size_t count,
+			   loff_t *ppos)
+{
+	char val[2] = { static_key_enabled(&evtrace_key) ? '1' : '0', '\n' };
+
+	return simple_read_from_buffer(buf, count, ppos, val, sizeof(val));
+}
+
+static ssize_t enable_write(struct file *file, const char __user *buf,
+			    size_t count, loff_t *ppos)
+{
+	bool on;
+	int ret;
+
+	ret = kstrtobool_from_user(buf, count, &on);
+	if (ret)
+		return ret;
+	if (on)
+		static_branch_enable(&evtrace_key);
+	else
+		static_branch_disable(&evtrace_key);
+	return count;
+}
+
+static const struct file_operations enable_fops = {
+	.owner		= THIS_MODULE,
+	.read		= enable_read,
+	.write		= enable_write,
+	.llseek		= default_llseek,
+};
+
+static void evtrace_free(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		kvfree(per_cpu_ptr(&evtrace_cpus, cpu)->ring);
+}
+
+static int evtrace_init(void)
+{
+	int cpu;
+
+	entries = roundup_pow_of_two(max(entries, 16U));
+	evtrace_mask = entries - 1;
+
+	for_each_possible_cpu(cpu) {
+		struct evtrace_cpu *c = per_cpu_ptr(&evtrace_cpus, cpu);
+
+		c->ring = kvzalloc_node(entries * sizeof(*c->ring), GFP_KERNEL,
+					cpu_to_node(cpu));
+		if (!c->ring) {
+			evtrace_free();
+			return -ENOMEM;
+		}
+	}
+
+	evtrace_dir = debugfs_create_dir("evtrace", NULL);
+	debugfs_create_file("trace", 0644, evtrace_dir, NULL, &trace_fops);
+	debugfs_create_file("enable", 0644, evtrace_dir, NULL, &enable_fops);
+
+	if (enable)
+		static_branch_enable(&evtrace_key);
+	return 0;
+}
+
+static void evtrace_exit(void)
+{
+	/* Users hold a module reference, nobody can be logging now */
+	debugfs_remove_recursive(evtrace_dir);
+	evtrace_free();
+}
+
+module_init(evtrace_init);
+module_exit(evtrace_exit);
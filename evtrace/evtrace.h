@@ -0,0 +1,25 @@
+/*
+ * evtrace.h -- per-CPU event log shared by the example drivers
+ */
+
+#ifndef _EVTRACE_H
+#define _EVTRACE_H
+
+#include <linux/jump_label.h>
+#include <linux/printk.h>
+
+DECLARE_STATIC_KEY_FALSE(evtrace_key);
+
+__printf(1, 2) void __evtrace(const char *fmt, ...);
+
+/*
+ * Use like printk, without a log level. While tracing is off this is a
+ * patched-out jump and the arguments are not even evaluated.
+ */
+#define evtrace(fmt, ...)						\
+do {									\
+	if (static_branch_unlikely(&evtrace_key))			\
+		__evtrace(fmt, ##__VA_ARGS__);				\
+} while (0)
+
+#endif /* _EVTRACE_H */
@@ -3,36 +3,142 @@
 #include <linux/proc_fs.h>
 #include <linux/mutex.h>
 #include <linux/kfifo.h>
+#include <linux/fs.h>
+#include <linux/miscdevice.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/uaccess.h>
 
 MODULE_LICENSE("Dual BSD/GPL");
 
+/*
+ * /dev/kfifo: a byte stream pipe backed by one large kfifo.
+ *
+ * kfifo needs no locking as long as there is only one reader and one
+ * writer at a time. Readers are serialized against each other by
+ * read_lock and writers by write_lock, so in the single producer /
+ * single consumer case neither lock is ever contended and the two
+ * sides never take a common lock. Data goes straight between the user
+ * buffer and the fifo with kfifo_from_user()/kfifo_to_user().
+ */
+
 //Declaration
-#define FIFO_SIZE 32
+#define FIFO_SIZE (1024 * 1024)
+static unsigned int fifo_size = FIFO_SIZE;	/* rounded up to a power of two */
+module_param(fifo_size, uint, 0444);
+
 struct kfifo test;
+static DEFINE_MUTEX(read_lock);
+static DEFINE_MUTEX(write_lock);
+static DECLARE_WAIT_QUEUE_HEAD(read_wq);
+static DECLARE_WAIT_QUEUE_HEAD(write_wq);
+
+static ssize_t fifo_read(struct file *file, char __user *buf, size_t count,
+			 loff_t *ppos)
+{
+	unsigned int copied;
+	int ret;
+
+	if (mutex_lock_interruptible(&read_lock))
+		return -ERESTARTSYS;
+
+	while (kfifo_is_empty(&test)) {
+		mutex_unlock(&read_lock);
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		if (wait_event_interruptible(read_wq, !kfifo_is_empty(&test)))
+			return -ERESTARTSYS;
+		if (mutex_lock_interruptible(&read_lock))
+			return -ERESTARTSYS;
+	}
+
+	ret = kfifo_to_user(&test, buf, count, &copied);
+	mutex_unlock(&read_lock);
+
+	if (copied)
+		wake_up_interruptible(&write_wq);
+	return ret ? ret : copied;
+}
+
+static ssize_t fifo_write(struct file *file, const char __user *buf,
+			  size_t count, loff_t *ppos)
+{
+	unsigned int copied;
+	int ret;
+
+	if (mutex_lock_interruptible(&write_lock))
+		return -ERESTARTSYS;
+
+	while (kfifo_is_full(&test)) {
+		mutex_unlock(&write_lock);
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		if (wait_event_interruptible(write_wq, !kfifo_is_full(&test)))
+			return -ERESTARTSYS;
+		if (mutex_lock_interruptible(&write_lock))
+			return -ERESTARTSYS;
+	}
+
+	ret = kfifo_from_user(&test, buf, count, &copied);
+	mutex_unlock(&write_lock);
+
+	if (copied)
+		wake_up_interruptible(&read_wq);
+	return ret ? ret : copied;
+}
+
+static __poll_t fifo_poll(struct file *file, poll_table *wait)
+{
+	__poll_t mask = 0;
+
+	poll_wait(file, &read_wq, wait);
+	poll_wait(file, &write_wq, wait);
+
+	if (!kfifo_is_empty(&test))
+		mask |= EPOLLIN | EPOLLRDNORM;
+	if (!kfifo_is_full(&test))
+		mask |= EPOLLOUT | EPOLLWRNORM;
+	return mask;
+}
+
+static const struct file_operations fifo_fops = {
+	.owner		= THIS_MODULE,
+	.read		= fifo_read,
+	.write		= fifo_write,
+	.poll		= fifo_poll,
+	.llseek		= noop_llseek,
+};
+
+static struct miscdevice fifo_misc = {
+	.minor		= MISC_DYNAMIC_MINOR,
+	.name		= "kfifo",
+	.fops		= &fifo_fops,
+};
 
 static int hello_init(void){
 	int ret;
-	unsigned char i;
-	unsigned char buf[6];
 
 	//Create the kfifo
-	ret = kfifo_alloc(&test, FIFO_SIZE, GFP_KERNEL);
-
-	//Put string into the fifo
-	kfifo_in(&test, "hello", 5);
+	ret = kfifo_alloc(&test, fifo_size, GFP_KERNEL);
+	if (ret) {
+		printk(KERN_ERR "kfifo: cannot allocate %u bytes\n", fifo_size);
+		return ret;
+	}
 
-	//Show the number of elements used
-	printk(KERN_INFO "fifo len: %u\n", kfifo_len(&test));
+	ret = misc_register(&fifo_misc);
+	if (ret) {
+		kfifo_free(&test);
+		return ret;
+	}
 
-	//Get the maximum of 5 bytes from fifo 
-	i = kfifo_out(&test, buf, 5);
-	printk(KERN_INFO "BUF: %.*s\n", i, buf);
-	
+	//Show the size actually used
+	printk(KERN_INFO "fifo size: %u\n", kfifo_size(&test));
 	return 0;
 }
 
 static void hello_exit(void){
 	printk("End of the Kfifo Library\n");
+	misc_deregister(&fifo_misc);
 	kfifo_free(&test);
 }
 
@@ -0,0 +1,353 @@
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/kfifo.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/mman.h>
+#include <linux/slab.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/sched.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/uaccess.h>
+
+MODULE_LICENSE("Dual BSD/GPL");
+
+/*
+ * kfifo microbenchmarks, driven through debugfs:
+ *
+ *	cd /sys/kernel/debug/kfifo_bench
+ *	echo 64 > elem_size; echo 2 > producer_cpu; echo 3 > consumer_cpu
+ *	echo 1 > run; cat results
+ *
+ * The single-threaded tests run in the context of the process writing
+ * to run, which also gives kfifo_to_user()/kfifo_from_user() a real user
+ * buffer. The SPSC tests move the same number of elements between a
+ * producer and a consumer kthread bound to the configured CPUs, once
+ * with the lockless kfifo_in()/kfifo_out() and once with the
+ * _spinlocked variants sharing one lock.
+ */
+
+static u32 fifo_size = 64 * 1024;	/* bytes, rounded up to a power of two */
+static u32 elem_size = 64;		/* bytes per operation */
+static u32 iterations = 1 << 20;
+static u32 producer_cpu;
+static u32 consumer_cpu = 1;
+
+/* Parameters of one run, copied at its start so debugfs writes can't race it */
+struct bench_cfg {
+	u32 fifo_size;
+	u32 elem_size;
+	u32 iterations;
+	u32 producer_cpu;
+	u32 consumer_cpu;
+};
+
+#define BENCH_MAX	8
+
+struct bench_result {
+	const char *name;
+	u64 ops;
+	u64 ns;
+	int err;
+};
+
+static struct bench_result results[BENCH_MAX];
+static int nr_results;
+static struct bench_cfg result_cfg;
+static DEFINE_MUTEX(bench_lock);
+static struct dentry *dbg_dir;
+
+static struct kfifo fifo;
+static DEFINE_SPINLOCK(spsc_lock);
+
+static void bench_record(const char *name, u64 ops, u64 ns, int err)
+{
+	results[nr_results++] = (struct bench_result){ name, ops, ns, err };
+}
+
+static void bench_in_out(const struct bench_cfg *cfg, char *buf)
+{
+	u64 t0, i;
+
+	kfifo_reset(&fifo);
+	t0 = ktime_get_ns();
+	for (i = 0; i < cfg->iterations; i++) {
+		kfifo_in(&fifo, buf, cfg->elem_size);
+		kfifo_out(&fifo, buf, cfg->elem_size);
+	}
+	bench_record("in_out", cfg->iterations, ktime_get_ns() - t0, 0);
+}
+
+static void bench_rec(const struct bench_cfg *cfg, char *buf)
+{
+	struct kfifo_rec_ptr_2 rec;
+	u64 t0, i;
+	int ret;
+
+	ret = kfifo_alloc(&rec, cfg->fifo_size, GFP_KERNEL);
+	if (ret || cfg->elem_size > 0xffff) {
+		bench_record("rec_in_out", 0, 0, ret ?: -EINVAL);
+		if (!ret)
+			kfifo_free(&rec);
+		return;
+	}
+	t0 = ktime_get_ns();
+	for (i = 0; i < cfg->iterations; i++) {
+		kfifo_in(&rec, buf, cfg->elem_size);
+		kfifo_out(&rec, buf, cfg->elem_size);
+	}
+	bench_record("rec_in_out", cfg->iterations, ktime_get_ns() - t0, 0);
+	kfifo_free(&rec);
+}
+
+/* Needs to run in process context with an mm */
+static void bench_user(const struct bench_cfg *cfg)
+{
+	unsigned long uaddr;
+	unsigned int copied;
+	u64 t0, i;
+	int ret = 0;
+
+	uaddr = vm_mmap(NULL, 0, cfg->elem_size, PROT_READ | PROT_WRITE,
+			MAP_ANONYMOUS | MAP_PRIVATE, 0);
+	if (IS_ERR_VALUE(uaddr)) {
+		bench_record("from_to_user", 0, 0, (int)uaddr);
+		return;
+	}
+
+	kfifo_reset(&fifo);
+	t0 = ktime_get_ns();
+	for (i = 0; i < cfg->iterations && !ret; i++) {
+		ret = kfifo_from_user(&fifo, (void __user *)uaddr, cfg->elem_size,
+				      &copied);
+		if (!ret)
+			ret = kfifo_to_user(&fifo, (void __user *)uaddr,
+					    cfg->elem_size, &copied);
+	}
+	bench_record("from_to_user", i, ktime_get_ns() - t0, ret);
+	vm_munmap(uaddr, cfg->elem_size);
+}
+
+/*
+ * SPSC: each side spins (with cond_resched() so a shared CPU still
+ * makes progress) until it has moved iterations elements. Sides only
+ * move whole elements: with a single producer and a single consumer
+ * the space or data they see can only grow until they act on it.
+ */
+struct spsc {
+	const struct bench_cfg *cfg;
+	bool locked;
+	char *buf;
+	atomic_t ready;
+	u64 t0, t1;
+	struct completion done;
+};
+
+static void spsc_start(struct spsc *s)
+{
+	atomic_inc(&s->ready);
+	while (atomic_read(&s->ready) < 2)
+		cond_resched();
+}
+
+static int spsc_producer(void *arg)
+{
+	struct spsc *s = arg;
+	u32 len = s->cfg->elem_size;
+	u64 i = 0;
+
+	spsc_start(s);
+	s->t0 = ktime_get_ns();
+	while (i < s->cfg->iterations) {
+		if (kfifo_avail(&fifo) < len) {
+			cond_resched();
+			continue;
+		}
+		if (s->locked)
+			kfifo_in_spinlocked(&fifo, s->buf, len, &spsc_lock);
+		else
+			kfifo_in(&fifo, s->buf, len);
+		i++;
+	}
+	complete(&s->done);
+	return 0;
+}
+
+static int spsc_consumer(void *arg)
+{
+	struct spsc *s = arg;
+	u32 len = s->cfg->elem_size;
+	char *buf = s->buf + len;
+	u64 i = 0;
+
+	spsc_start(s);
+	while (i < s->cfg->iterations) {
+		if (kfifo_len(&fifo) < len) {
+			cond_resched();
+			continue;
+		}
+		if (s->locked)
+			kfifo_out_spinlocked(&fifo, buf, len, &spsc_lock);
+		else
+			kfifo_out(&fifo, buf, len);
+		i++;
+	}
+	s->t1 = ktime_get_ns();
+	complete(&s->done);
+	return 0;
+}
+
+static void bench_spsc(const struct bench_cfg *cfg, bool locked)
+{
+	const char *name = locked ? "spsc_locked" : "spsc_lockless";
+	struct task_struct *p, *c;
+	struct spsc s = { .cfg = cfg, .locked = locked };
+
+	if (cfg->producer_cpu >= nr_cpu_ids || cfg->consumer_cpu >= nr_cpu_ids ||
+	    !cpu_online(cfg->producer_cpu) || !cpu_online(cfg->consumer_cpu)) {
+		bench_record(name, 0, 0, -EINVAL);
+		return;
+	}
+	s.buf = kmalloc(2 * cfg->elem_size, GFP_KERNEL);
+	if (!s.buf) {
+		bench_record(name, 0, 0, -ENOMEM);
+		return;
+	}
+	atomic_set(&s.ready, 0);
+	init_completion(&s.done);
+	kfifo_reset(&fifo);
+
+	p = kthread_create(spsc_producer, &s, "kfifo_bench_p");
+	c = kthread_create(spsc_consumer, &s, "kfifo_bench_c");
+	if (IS_ERR(p) || IS_ERR(c)) {
+		/* Never woken, so kthread_stop() makes them exit unrun */
+		if (!IS_ERR(p))
+			kthread_stop(p);
+		if (!IS_ERR(c))
+			kthread_stop(c);
+		bench_record(name, 0, 0, -ENOMEM);
+		kfree(s.buf);
+		return;
+	}
+	kthread_bind(p, cfg->producer_cpu);
+	kthread_bind(c, cfg->consumer_cpu);
+	wake_up_process(p);
+	wake_up_process(c);
+	wait_for_completion(&s.done);
+	wait_for_completion(&s.done);
+
+	bench_record(name, cfg->iterations, s.t1 - s.t0, 0);
+	kfree(s.buf);
+}
+
+static void bench_run(const struct bench_cfg *cfg)
+{
+	char *buf;
+
+	nr_results = 0;
+	result_cfg = *cfg;
+	buf = kmalloc(cfg->elem_size, GFP_KERNEL);
+	if (!buf)
+		return;
+	memset(buf, 0x5a, cfg->elem_size);
+
+	bench_in_out(cfg, buf);
+	bench_rec(cfg, buf);
+	bench_user(cfg);
+	bench_spsc(cfg, false);
+	bench_spsc(cfg, true);
+	kfree(buf);
+}
+
+static ssize_t run_write(struct file *file, const char __user *ubuf,
+			 size_t count, loff_t *ppos)
+{
+	struct bench_cfg cfg;
+	int ret;
+
+	if (mutex_lock_interruptible(&bench_lock))
+		return -ERESTARTSYS;
+
+	cfg = (struct bench_cfg){
+		.fifo_size	= READ_ONCE(fifo_size),
+		.elem_size	= READ_ONCE(elem_size),
+		.iterations	= READ_ONCE(iterations),
+		.producer_cpu	= READ_ONCE(producer_cpu),
+		.consumer_cpu	= READ_ONCE(consumer_cpu),
+	};
+	if (!cfg.fifo_size || !cfg.elem_size || !cfg.iterations) {
+		mutex_unlock(&bench_lock);
+		return -EINVAL;
+	}
+
+	kfifo_free(&fifo);
+	ret = kfifo_alloc(&fifo, cfg.fifo_size, GFP_KERNEL);
+	if (!ret && kfifo_size(&fifo) < cfg.elem_size)
+		ret = -EINVAL;
+	if (!ret)
+		bench_run(&cfg);
+	mutex_unlock(&bench_lock);
+	return ret ? ret : count;
+}
+
+static const struct file_operations run_fops = {
+	.owner	= THIS_MODULE,
+	.write	= run_write,
+	.llseek	= noop_llseek,
+};
+
+static int results_show(struct seq_file *m, void *v)
+{
+	int i;
+
+	mutex_lock(&bench_lock);
+	seq_printf(m, "# elem_size %u fifo_size %u cpus %u->%u\n",
+		   result_cfg.elem_size, kfifo_size(&fifo),
+		   result_cfg.producer_cpu, result_cfg.consumer_cpu);
+	seq_puts(m, "# test ops ns ns_per_op GB_per_s\n");
+	for (i = 0; i < nr_results; i++) {
+		struct bench_result *r = &results[i];
+		u64 bytes = r->ops * result_cfg.elem_size;
+		/* bytes per ns == GB/s, kept to three decimals */
+		u64 mgbs = div64_u64(bytes * 1000, r->ns ?: 1);
+
+		if (r->err) {
+			seq_printf(m, "%s error %d\n", r->name, r->err);
+			continue;
+		}
+		seq_printf(m, "%s %llu %llu %llu %llu.%03llu\n", r->name, r->ops,
+			   r->ns, div64_u64(r->ns, r->ops ?: 1),
+			   mgbs / 1000, mgbs % 1000);
+	}
+	mutex_unlock(&bench_lock);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(results);
+
+static int bench_init(void)
+{
+	dbg_dir = debugfs_create_dir("kfifo_bench", NULL);
+	debugfs_create_u32("fifo_size", 0644, dbg_dir, &fifo_size);
+	debugfs_create_u32("elem_size", 0644, dbg_dir, &elem_size);
+	debugfs_create_u32("iterations", 0644, dbg_dir, &iterations);
+	debugfs_create_u32("producer_cpu", 0644, dbg_dir, &producer_cpu);
+	debugfs_create_u32("consumer_cpu", 0644, dbg_dir, &consumer_cpu);
+	debugfs_create_file("run", 0200, dbg_dir, NULL, &run_fops);
+	debugfs_create_file("results", 0444, dbg_dir, NULL, &results_fops);
+	return 0;
+}
+
+static void bench_exit(void)
+{
+	debugfs_remove_recursive(dbg_dir);
+	kfifo_free(&fifo);
+}
+
+module_init(bench_init);
+module_exit(bench_exit);
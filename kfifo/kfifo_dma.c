@@ -0,0 +1,419 @@
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/kfifo.h>
+#include <linux/fs.h>
+#include <linux/miscdevice.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/kthread.h>
+#include <linux/delay.h>
+#include <linux/completion.h>
+#include <linux/scatterlist.h>
+#include <linux/dmaengine.h>
+#include <linux/dma-mapping.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/uaccess.h>
+
+MODULE_LICENSE("Dual BSD/GPL");
+
+/*
+ * /dev/kfifo_dma: zero-copy capture into a kfifo.
+ *
+ * A kthread plays the part of a capture device. Each round it asks
+ * kfifo_dma_in_prepare() for a scatterlist over the free part of the
+ * fifo (two entries when the free space wraps), maps it and has a
+ * dmaengine memcpy channel copy a source buffer straight into fifo
+ * memory, then commits with kfifo_dma_in_finish(). No bounce buffer is
+ * involved; porting to real hardware means replacing the memcpy
+ * descriptors with the device's slave descriptors.
+ *
+ * With dma_drain set the thread also empties the fifo the same way,
+ * through kfifo_dma_out_prepare() into a sink buffer, so the pair can
+ * run flat out; otherwise the data is read from /dev/kfifo_dma.
+ * Without a memcpy channel the same scatterlists are filled by the CPU,
+ * which gives a baseline to compare against.
+ *
+ * Nothing runs until asked to; a run is started and stopped through
+ * debugfs and its throughput reported next to it:
+ *
+ *	echo 1 > /sys/kernel/debug/kfifo_dma/run
+ *	cat /sys/kernel/debug/kfifo_dma/stats
+ *	echo 0 > /sys/kernel/debug/kfifo_dma/run
+ */
+
+static unsigned int fifo_size = 1024 * 1024;	/* rounded up to a power of two */
+module_param(fifo_size, uint, 0444);
+
+static unsigned int chunk = 64 * 1024;		/* largest single transfer */
+module_param(chunk, uint, 0444);
+
+static bool dma_drain = true;
+module_param(dma_drain, bool, 0444);
+
+static struct kfifo fifo;
+static struct dma_chan *chan;
+static struct device *dma_dev;
+static void *src_buf, *sink_buf;
+static dma_addr_t src_dma, sink_dma;
+
+static struct task_struct *stream_task;	/* non-NULL while a run is on */
+static DEFINE_MUTEX(run_lock);
+static DEFINE_MUTEX(read_lock);
+static DECLARE_WAIT_QUEUE_HEAD(read_wq);
+static DECLARE_WAIT_QUEUE_HEAD(space_wq);
+static struct dentry *dbg_dir;
+
+static struct {
+	u64 bytes_in;
+	u64 bytes_out;
+	u64 xfers;
+	u64 errors;
+	u64 start_ns;
+	u64 stop_ns;
+} stats;
+
+static void dma_done(void *arg)
+{
+	complete(arg);
+}
+
+/*
+ * Copy between the fifo scatterlist and the peer buffer, in the
+ * direction given by @dir (DMA_FROM_DEVICE fills the fifo). Returns the
+ * number of bytes moved.
+ */
+static int fifo_xfer(struct scatterlist *sgl, int nents, unsigned int len,
+		     enum dma_data_direction dir)
+{
+	DECLARE_COMPLETION_ONSTACK(done);
+	struct dma_async_tx_descriptor *tx;
+	struct scatterlist *sg;
+	dma_addr_t peer = dir == DMA_FROM_DEVICE ? src_dma : sink_dma;
+	unsigned int off = 0;
+	int mapped, i, ret = len;
+
+	if (!chan) {
+		char *cpu_peer = dir == DMA_FROM_DEVICE ? src_buf : sink_buf;
+
+		for_each_sg(sgl, sg, nents, i) {
+			if (dir == DMA_FROM_DEVICE)
+				memcpy(sg_virt(sg), cpu_peer + off, sg->length);
+			else
+				memcpy(cpu_peer + off, sg_virt(sg), sg->length);
+			off += sg->length;
+		}
+		return len;
+	}
+
+	mapped = dma_map_sg(dma_dev, sgl, nents, dir);
+	if (!mapped)
+		return -ENOMEM;
+
+	for_each_sg(sgl, sg, mapped, i) {
+		dma_addr_t fifo_addr = sg_dma_address(sg);
+		unsigned long flags = DMA_CTRL_ACK;
+
+		if (i == mapped - 1)
+			flags |= DMA_PREP_INTERRUPT;
+		tx = dmaengine_prep_dma_memcpy(chan,
+				dir == DMA_FROM_DEVICE ? fifo_addr : peer + off,
+				dir == DMA_FROM_DEVICE ? peer + off : fifo_addr,
+				sg_dma_len(sg), flags);
+		if (!tx) {
+			ret = -EIO;
+			break;
+		}
+		if (i == mapped - 1) {
+			tx->callback = dma_done;
+			tx->callback_param = &done;
+		}
+		if (dma_submit_error(dmaengine_submit(tx))) {
+			ret = -EIO;
+			break;
+		}
+		off += sg_dma_len(sg);
+	}
+
+	if (ret > 0) {
+		dma_async_issue_pending(chan);
+		if (!wait_for_completion_timeout(&done, msecs_to_jiffies(1000)))
+			ret = -ETIMEDOUT;
+	}
+	if (ret < 0)
+		dmaengine_terminate_sync(chan);
+	dma_unmap_sg(dma_dev, sgl, nents, dir);
+	return ret;
+}
+
+static int fifo_fill(void)
+{
+	struct scatterlist sg[2];
+	unsigned int len = min(kfifo_avail(&fifo), chunk);
+	int nents, ret;
+
+	sg_init_table(sg, ARRAY_SIZE(sg));
+	nents = kfifo_dma_in_prepare(&fifo, sg, ARRAY_SIZE(sg), len);
+	if (!nents)
+		return 0;
+	ret = fifo_xfer(sg, nents, len, DMA_FROM_DEVICE);
+	if (ret > 0) {
+		kfifo_dma_in_finish(&fifo, ret);
+		stats.bytes_in += ret;
+		stats.xfers++;
+	}
+	return ret;
+}
+
+static int fifo_drain(void)
+{
+	struct scatterlist sg[2];
+	unsigned int len = min(kfifo_len(&fifo), chunk);
+	int nents, ret;
+
+	sg_init_table(sg, ARRAY_SIZE(sg));
+	nents = kfifo_dma_out_prepare(&fifo, sg, ARRAY_SIZE(sg), len);
+	if (!nents)
+		return 0;
+	ret = fifo_xfer(sg, nents, len, DMA_TO_DEVICE);
+	if (ret > 0) {
+		kfifo_dma_out_finish(&fifo, ret);
+		stats.bytes_out += ret;
+	}
+	return ret;
+}
+
+static int stream_fn(void *unused)
+{
+	int ret;
+
+	while (!kthread_should_stop()) {
+		if (!dma_drain &&
+		    wait_event_interruptible(space_wq, kthread_should_stop() ||
+					     !kfifo_is_full(&fifo)))
+			continue;
+		if (kthread_should_stop())
+			break;
+
+		ret = fifo_fill();
+		if (ret > 0 && dma_drain)
+			ret = fifo_drain();
+		else if (ret > 0)
+			wake_up_interruptible(&read_wq);
+		if (ret < 0) {
+			stats.errors++;
+			msleep_interruptible(10);
+		}
+		cond_resched();
+	}
+	return 0;
+}
+
+static ssize_t kdma_read(struct file *file, char __user *buf, size_t count,
+			 loff_t *ppos)
+{
+	unsigned int copied;
+	int ret;
+
+	if (dma_drain)
+		return -EBUSY;
+	if (mutex_lock_interruptible(&read_lock))
+		return -ERESTARTSYS;
+
+	while (kfifo_is_empty(&fifo)) {
+		mutex_unlock(&read_lock);
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		if (wait_event_interruptible(read_wq, !kfifo_is_empty(&fifo)))
+			return -ERESTARTSYS;
+		if (mutex_lock_interruptible(&read_lock))
+			return -ERESTARTSYS;
+	}
+
+	ret = kfifo_to_user(&fifo, buf, count, &copied);
+	stats.bytes_out += copied;
+	mutex_unlock(&read_lock);
+
+	if (copied)
+		wake_up_interruptible(&space_wq);
+	return ret ? ret : copied;
+}
+
+static __poll_t kdma_poll(struct file *file, poll_table *wait)
+{
+	poll_wait(file, &read_wq, wait);
+	return kfifo_is_empty(&fifo) ? 0 : EPOLLIN | EPOLLRDNORM;
+}
+
+static const struct file_operations kdma_fops = {
+	.owner		= THIS_MODULE,
+	.read		= kdma_read,
+	.poll		= kdma_poll,
+	.llseek		= noop_llseek,
+};
+
+static struct miscdevice kdma_misc = {
+	.minor		= MISC_DYNAMIC_MINOR,
+	.name		= "kfifo_dma",
+	.fops		= &kdma_fops,
+};
+
+static int stats_show(struct seq_file *m, void *v)
+{
+	u64 start = READ_ONCE(stats.start_ns), stop = READ_ONCE(stats.stop_ns);
+	u64 ns = start ? (stop ?: ktime_get_ns()) - start : 0;
+	u64 in = READ_ONCE(stats.bytes_in), out = READ_ONCE(stats.bytes_out);
+
+	seq_printf(m, "engine:     %s\n", chan ? dma_chan_name(chan) : "cpu");
+	seq_printf(m, "bytes_in:   %llu\n", in);
+	seq_printf(m, "bytes_out:  %llu\n", out);
+	seq_printf(m, "transfers:  %llu\n", READ_ONCE(stats.xfers));
+	seq_printf(m, "errors:     %llu\n", READ_ONCE(stats.errors));
+	seq_printf(m, "elapsed_ns: %llu\n", ns);
+	/* bytes per microsecond == MB/s */
+	seq_printf(m, "in_MBps:    %llu\n", div64_u64(in * 1000, ns ?: 1));
+	seq_printf(m, "out_MBps:   %llu\n", div64_u64(out * 1000, ns ?: 1));
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(stats);
+
+static int kdma_start(void)
+{
+	struct task_struct *t;
+
+	if (stream_task)
+		return 0;
+	mutex_lock(&read_lock);
+	kfifo_reset(&fifo);
+	mutex_unlock(&read_lock);
+	memset(&stats, 0, sizeof(stats));
+	stats.start_ns = ktime_get_ns();
+
+	t = kthread_run(stream_fn, NULL, "kfifo_dma");
+	if (IS_ERR(t))
+		return PTR_ERR(t);
+	stream_task = t;
+	return 0;
+}
+
+static void kdma_stop(void)
+{
+	if (!stream_task)
+		return;
+	kthread_stop(stream_task);
+	stream_task = NULL;
+	stats.stop_ns = ktime_get_ns();
+}
+
+static ssize_t run_read(struct file *file, char __user *buf, size_t count,
+			loff_t *ppos)
+{
+	char val[2] = { READ_ONCE(stream_task) ? '1' : '0', '\n' };
+
+	return simple_read_from_buffer(buf, count, ppos, val, sizeof(val));
+}
+
+static ssize_t run_write(struct file *file, const char __user *buf,
+			 size_t count, loff_t *ppos)
+{
+	bool on;
+	int ret;
+
+	ret = kstrtobool_from_user(buf, count, &on);
+	if (ret)
+		return ret;
+	mutex_lock(&run_lock);
+	if (on)
+		ret = kdma_start();
+	else
+		kdma_stop();
+	mutex_unlock(&run_lock);
+	return ret ? ret : count;
+}
+
+static const struct file_operations run_fops = {
+	.owner	= THIS_MODULE,
+	.read	= run_read,
+	.write	= run_write,
+	.llseek	= default_llseek,
+};
+
+static int kdma_init(void)
+{
+	dma_cap_mask_t mask;
+	int ret;
+
+	chunk = max_t(unsigned int, chunk, PAGE_SIZE);
+	/* kmalloc memory, so the scatterlists can be mapped for DMA */
+	ret = kfifo_alloc(&fifo, fifo_size, GFP_KERNEL);
+	if (ret)
+		return ret;
+	src_buf = kmalloc(chunk, GFP_KERNEL);
+	sink_buf = kmalloc(chunk, GFP_KERNEL);
+	ret = -ENOMEM;
+	if (!src_buf || !sink_buf)
+		goto err_buf;
+	memset(src_buf, 0xa5, chunk);
+
+	dma_cap_zero(mask);
+	dma_cap_set(DMA_MEMCPY, mask);
+	chan = dma_request_channel(mask, NULL, NULL);
+	if (chan) {
+		dma_dev = chan->device->dev;
+		src_dma = dma_map_single(dma_dev, src_buf, chunk, DMA_TO_DEVICE);
+		sink_dma = dma_map_single(dma_dev, sink_buf, chunk, DMA_FROM_DEVICE);
+		if (dma_mapping_error(dma_dev, src_dma) ||
+		    dma_mapping_error(dma_dev, sink_dma)) {
+			ret = -EIO;
+			goto err_map;
+		}
+	} else {
+		printk(KERN_INFO "kfifo_dma: no memcpy channel, copying with the CPU\n");
+	}
+
+	ret = misc_register(&kdma_misc);
+	if (ret)
+		goto err_map;
+
+	dbg_dir = debugfs_create_dir("kfifo_dma", NULL);
+	debugfs_create_file("stats", 0444, dbg_dir, NULL, &stats_fops);
+	debugfs_create_file("run", 0644, dbg_dir, NULL, &run_fops);
+	return 0;
+
+err_map:
+	if (chan) {
+		if (!dma_mapping_error(dma_dev, src_dma))
+			dma_unmap_single(dma_dev, src_dma, chunk, DMA_TO_DEVICE);
+		if (!dma_mapping_error(dma_dev, sink_dma))
+			dma_unmap_single(dma_dev, sink_dma, chunk, DMA_FROM_DEVICE);
+		dma_release_channel(chan);
+	}
+err_buf:
+	kfree(sink_buf);
+	kfree(src_buf);
+	kfifo_free(&fifo);
+	return ret;
+}
+
+static void kdma_exit(void)
+{
+	debugfs_remove_recursive(dbg_dir);
+	mutex_lock(&run_lock);
+	kdma_stop();
+	mutex_unlock(&run_lock);
+	misc_deregister(&kdma_misc);
+	if (chan) {
+		dma_unmap_single(dma_dev, src_dma, chunk, DMA_TO_DEVICE);
+		dma_unmap_single(dma_dev, sink_dma, chunk, DMA_FROM_DEVICE);
+		dma_release_channel(chan);
+	}
+	kfree(sink_buf);
+	kfree(src_buf);
+	kfifo_free(&fifo);
+}
+
+module_init(kdma_init);
+module_exit(kdma_exit);
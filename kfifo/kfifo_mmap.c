@@ -0,0 +1,247 @@
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/log2.h>
+#include <linux/miscdevice.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/uaccess.h>
+#include <linux/version.h>
+
+#include "kfifo_mmap.h"
+
+MODULE_LICENSE("Dual BSD/GPL");
+
+/*
+ * /dev/kfifo_mmap: a kfifo-style ring whose buffer and in/out indices
+ * live in pages userspace can mmap, so a reader (or writer) working on
+ * the mapping moves data without any syscall while the ring is neither
+ * empty nor full. See kfifo_mmap.h for the protocol.
+ *
+ * write() and read() still work for peers that don't map the ring; they
+ * follow the same protocol from the kernel side. Anything that comes
+ * from the shared page is checked before it is used to index memory.
+ */
+
+static unsigned int ring_size = 1024 * 1024;	/* rounded up to a power of two */
+module_param(ring_size, uint, 0444);
+
+static void *ring_mem;				/* control page + data */
+static struct kfifo_mmap_ctrl *ctrl;
+static char *data;
+static u32 size, mask;
+
+static DEFINE_MUTEX(read_lock);
+static DEFINE_MUTEX(write_lock);
+static DECLARE_WAIT_QUEUE_HEAD(data_wq);
+static DECLARE_WAIT_QUEUE_HEAD(space_wq);
+
+/*
+ * Sleep until *idx differs from @seen. The flag is raised before the
+ * index is looked at again, pairing with the exchange in mring_wake().
+ */
+static int mring_wait(u32 *idx, u32 seen, u32 *flag, wait_queue_head_t *wq)
+{
+	WRITE_ONCE(*flag, 1);
+	smp_mb();
+	return wait_event_interruptible(*wq, READ_ONCE(*idx) != seen);
+}
+
+/* Called after publishing an index; xchg orders the two accesses. */
+static void mring_wake(u32 *flag, wait_queue_head_t *wq)
+{
+	if (xchg(flag, 0))
+		wake_up_interruptible(wq);
+}
+
+static ssize_t mring_read(struct file *file, char __user *buf, size_t count,
+			  loff_t *ppos)
+{
+	u32 in, out, used, off, first, n;
+	ssize_t ret;
+
+	if (mutex_lock_interruptible(&read_lock))
+		return -ERESTARTSYS;
+
+	for (;;) {
+		out = READ_ONCE(ctrl->out);
+		in = smp_load_acquire(&ctrl->in);
+		used = in - out;
+		if (used > size) {
+			ret = -EIO;
+			goto unlock;
+		}
+		if (used)
+			break;
+		if (file->f_flags & O_NONBLOCK) {
+			ret = -EAGAIN;
+			goto unlock;
+		}
+		mutex_unlock(&read_lock);
+		if (mring_wait(&ctrl->in, in, &ctrl->data_waiting, &data_wq))
+			return -ERESTARTSYS;
+		if (mutex_lock_interruptible(&read_lock))
+			return -ERESTARTSYS;
+	}
+
+	n = min_t(size_t, count, used);
+	off = out & mask;
+	first = min(n, size - off);
+	if (copy_to_user(buf, data + off, first) ||
+	    copy_to_user(buf + first, data, n - first)) {
+		ret = -EFAULT;
+		goto unlock;
+	}
+	smp_store_release(&ctrl->out, out + n);
+	mring_wake(&ctrl->space_waiting, &space_wq);
+	ret = n;
+unlock:
+	mutex_unlock(&read_lock);
+	return ret;
+}
+
+static ssize_t mring_write(struct file *file, const char __user *buf,
+			   size_t count, loff_t *ppos)
+{
+	u32 in, out, room, off, first, n;
+	ssize_t ret;
+
+	if (mutex_lock_interruptible(&write_lock))
+		return -ERESTARTSYS;
+
+	for (;;) {
+		in = READ_ONCE(ctrl->in);
+		out = smp_load_acquire(&ctrl->out);
+		room = size - (in - out);
+		if (room > size) {
+			ret = -EIO;
+			goto unlock;
+		}
+		if (room)
+			break;
+		if (file->f_flags & O_NONBLOCK) {
+			ret = -EAGAIN;
+			goto unlock;
+		}
+		mutex_unlock(&write_lock);
+		if (mring_wait(&ctrl->out, out, &ctrl->space_waiting, &space_wq))
+			return -ERESTARTSYS;
+		if (mutex_lock_interruptible(&write_lock))
+			return -ERESTARTSYS;
+	}
+
+	n = min_t(size_t, count, room);
+	off = in & mask;
+	first = min(n, size - off);
+	if (copy_from_user(data + off, buf, first) ||
+	    copy_from_user(data, buf + first, n - first)) {
+		ret = -EFAULT;
+		goto unlock;
+	}
+	smp_store_release(&ctrl->in, in + n);
+	mring_wake(&ctrl->data_waiting, &data_wq);
+	ret = n;
+unlock:
+	mutex_unlock(&write_lock);
+	return ret;
+}
+
+static __poll_t mring_poll(struct file *file, poll_table *wait)
+{
+	__poll_t mask = 0;
+	u32 used;
+
+	poll_wait(file, &data_wq, wait);
+	poll_wait(file, &space_wq, wait);
+
+	WRITE_ONCE(ctrl->data_waiting, 1);
+	WRITE_ONCE(ctrl->space_waiting, 1);
+	smp_mb();
+	used = READ_ONCE(ctrl->in) - READ_ONCE(ctrl->out);
+	if (used)
+		mask |= EPOLLIN | EPOLLRDNORM;
+	if (used < size)
+		mask |= EPOLLOUT | EPOLLWRNORM;
+	return mask;
+}
+
+static long mring_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	u32 seen;
+
+	switch (cmd) {
+	case KFIFO_MMAP_WAIT_DATA:
+		if (get_user(seen, (u32 __user *)arg))
+			return -EFAULT;
+		return mring_wait(&ctrl->in, seen, &ctrl->data_waiting, &data_wq);
+	case KFIFO_MMAP_WAIT_SPACE:
+		if (get_user(seen, (u32 __user *)arg))
+			return -EFAULT;
+		return mring_wait(&ctrl->out, seen, &ctrl->space_waiting, &space_wq);
+	case KFIFO_MMAP_WAKE:
+		wake_up_interruptible(&data_wq);
+		wake_up_interruptible(&space_wq);
+		return 0;
+	}
+	return -ENOTTY;
+}
+
+static int mring_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	/* Bounds are checked against the vmalloc area */
+	return remap_vmalloc_range(vma, ring_mem, vma->vm_pgoff);
+}
+
+static const struct file_operations mring_fops = {
+	.owner		= THIS_MODULE,
+	.read		= mring_read,
+	.write		= mring_write,
+	.poll		= mring_poll,
+	.unlocked_ioctl	= mring_ioctl,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,5,0)
+	.compat_ioctl	= compat_ptr_ioctl,
+#endif
+	.mmap		= mring_mmap,
+	.llseek		= noop_llseek,
+};
+
+static struct miscdevice mring_misc = {
+	.minor		= MISC_DYNAMIC_MINOR,
+	.name		= "kfifo_mmap",
+	.fops		= &mring_fops,
+};
+
+static int mring_init(void)
+{
+	int ret;
+
+	size = roundup_pow_of_two(max_t(unsigned int, ring_size, PAGE_SIZE));
+	mask = size - 1;
+
+	/* Zeroed and suitable for remap_vmalloc_range() */
+	ring_mem = vmalloc_user(PAGE_SIZE + size);
+	if (!ring_mem)
+		return -ENOMEM;
+	ctrl = ring_mem;
+	data = ring_mem + PAGE_SIZE;
+	ctrl->size = size;
+	ctrl->mask = mask;
+	ctrl->data_offset = PAGE_SIZE;
+
+	ret = misc_register(&mring_misc);
+	if (ret)
+		vfree(ring_mem);
+	return ret;
+}
+
+static void mring_exit(void)
+{
+	misc_deregister(&mring_misc);
+	vfree(ring_mem);
+}
+
+module_init(mring_init);
+module_exit(mring_exit);
@@ -0,0 +1,49 @@
+/*
+ * kfifo_mmap.h -- layout and ioctls of /dev/kfifo_mmap, shared with userspace
+ */
+
+#ifndef _KFIFO_MMAP_H
+#define _KFIFO_MMAP_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * The device is one control page followed by the data pages, all of it
+ * mappable with a single mmap() at offset 0. in and out are
+ * free-running byte counters as in struct kfifo: the fill level is
+ * in - out and a position in the data area is (index & mask). There is
+ * one producer and one consumer; either side may be a process working
+ * on the mapping or a process using write()/read().
+ *
+ * Producer: write data, then store-release in.
+ * Consumer: load-acquire in, read data in place, then store-release out.
+ *
+ * A side that finds nothing to do may spin for a while and then sleep
+ * with KFIFO_MMAP_WAIT_DATA/WAIT_SPACE, passing the index value it last
+ * saw. The kernel sets data_waiting (space_waiting) before checking the
+ * index again, so after publishing an index the other side does
+ *
+ *	if (__atomic_exchange_n(&ctrl->data_waiting, 0, __ATOMIC_SEQ_CST))
+ *		ioctl(fd, KFIFO_MMAP_WAKE);
+ *
+ * and only pays for a syscall when somebody actually sleeps.
+ */
+struct kfifo_mmap_ctrl {
+	__u32 in;
+	__u32 data_waiting;	/* consumer sleeps until in moves */
+	__u32 __pad0[14];
+	__u32 out;
+	__u32 space_waiting;	/* producer sleeps until out moves */
+	__u32 __pad1[14];
+	__u32 size;		/* bytes in the data area, a power of two */
+	__u32 mask;		/* size - 1 */
+	__u32 data_offset;	/* mmap offset of the data area */
+};
+
+#define KFIFO_MMAP_MAGIC	'q'
+#define KFIFO_MMAP_WAIT_DATA	_IOW(KFIFO_MMAP_MAGIC, 1, __u32)
+#define KFIFO_MMAP_WAIT_SPACE	_IOW(KFIFO_MMAP_MAGIC, 2, __u32)
+#define KFIFO_MMAP_WAKE		_IO(KFIFO_MMAP_MAGIC, 3)
+
+#endif /* _KFIFO_MMAP_H */
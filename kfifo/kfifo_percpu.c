@@ -0,0 +1,293 @@
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/kfifo.h>
+#include <linux/percpu.h>
+#include <linux/spinlock.h>
+#include <linux/slab.h>
+#include <linux/fs.h>
+#include <linux/miscdevice.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/ktime.h>
+#include <linux/uaccess.h>
+
+#include "kfifo_percpu.h"
+
+MODULE_LICENSE("Dual BSD/GPL");
+
+/*
+ * A multi-producer fifo made of one kfifo per CPU.
+ *
+ * Producers only ever push to the shard of the CPU they run on, with
+ * local interrupts off, so every shard has exactly one producer at a
+ * time and no producer ever takes a lock or touches another CPU's
+ * cache lines. Consumers are serialized by drain_lock and pull events
+ * from all shards in batches, either shard by shard or merged into
+ * timestamp order. The merge only orders what is visible at drain
+ * time; an event still being pushed on another CPU can show up in the
+ * next batch with an earlier timestamp.
+ *
+ * The facility is exported for other modules and also backs
+ * /dev/kfifo_percpu: write() pushes to the writer's CPU, read() returns
+ * whole struct pcpu_event records.
+ */
+
+struct pcpu_fifo_shard {
+	DECLARE_KFIFO_PTR(fifo, struct pcpu_event);
+	unsigned long dropped;		/* only written by the owning CPU */
+};
+
+struct pcpu_fifo {
+	struct pcpu_fifo_shard __percpu *shards;
+	spinlock_t drain_lock;
+	unsigned int next_cpu;		/* where the next unmerged drain starts */
+	wait_queue_head_t wq;
+};
+
+struct pcpu_fifo *pcpu_fifo_create(unsigned int events_per_cpu)
+{
+	struct pcpu_fifo *pf;
+	int cpu;
+
+	pf = kzalloc(sizeof(*pf), GFP_KERNEL);
+	if (!pf)
+		return NULL;
+	pf->shards = alloc_percpu(struct pcpu_fifo_shard);
+	if (!pf->shards)
+		goto err;
+
+	for_each_possible_cpu(cpu) {
+		struct pcpu_fifo_shard *s = per_cpu_ptr(pf->shards, cpu);
+
+		if (kfifo_alloc(&s->fifo, events_per_cpu, GFP_KERNEL))
+			goto err;
+	}
+	spin_lock_init(&pf->drain_lock);
+	init_waitqueue_head(&pf->wq);
+	return pf;
+err:
+	pcpu_fifo_destroy(pf);
+	return NULL;
+}
+EXPORT_SYMBOL_GPL(pcpu_fifo_create);
+
+void pcpu_fifo_destroy(struct pcpu_fifo *pf)
+{
+	int cpu;
+
+	if (pf->shards) {
+		for_each_possible_cpu(cpu)
+			kfifo_free(&per_cpu_ptr(pf->shards, cpu)->fifo);
+		free_percpu(pf->shards);
+	}
+	kfree(pf);
+}
+EXPORT_SYMBOL_GPL(pcpu_fifo_destroy);
+
+/*
+ * Push one event (truncated to PCPU_EVENT_DATA bytes) onto this CPU's
+ * shard. Safe from any context. Returns -ENOSPC, and counts a drop, if
+ * the shard is full.
+ */
+int pcpu_fifo_push(struct pcpu_fifo *pf, const void *data, unsigned int len)
+{
+	struct pcpu_fifo_shard *s;
+	struct pcpu_event ev = {};	/* whole events are copied to userspace */
+	unsigned long flags;
+	int ret = 0;
+
+	ev.len = min_t(unsigned int, len, PCPU_EVENT_DATA);
+	memcpy(ev.data, data, ev.len);
+
+	local_irq_save(flags);
+	s = this_cpu_ptr(pf->shards);
+	ev.cpu = smp_processor_id();
+	ev.ts = ktime_get_ns();		/* taken in order with the shard */
+	if (!kfifo_put(&s->fifo, ev)) {
+		s->dropped++;
+		ret = -ENOSPC;
+	}
+	local_irq_restore(flags);
+
+	if (!ret && wq_has_sleeper(&pf->wq))
+		wake_up_interruptible(&pf->wq);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(pcpu_fifo_push);
+
+/*
+ * Move up to @n events into @ev. Without @merge the shards are emptied
+ * one after the other, starting where the previous drain stopped so no
+ * CPU is starved; with @merge the oldest head of all shards is taken
+ * each time.
+ */
+unsigned int pcpu_fifo_drain(struct pcpu_fifo *pf, struct pcpu_event *ev,
+			     unsigned int n, bool merge)
+{
+	struct pcpu_fifo_shard *s, *best;
+	struct pcpu_event head;
+	unsigned int got = 0, i, cpu;
+	u64 best_ts;
+
+	spin_lock_bh(&pf->drain_lock);
+	if (!merge) {
+		for (i = 0; i < nr_cpu_ids && got < n; i++) {
+			cpu = (pf->next_cpu + i) % nr_cpu_ids;
+			if (!cpu_possible(cpu))
+				continue;
+			s = per_cpu_ptr(pf->shards, cpu);
+			got += kfifo_out(&s->fifo, ev + got, n - got);
+		}
+		pf->next_cpu = (pf->next_cpu + i) % nr_cpu_ids;
+	} else {
+		while (got < n) {
+			best = NULL;
+			best_ts = U64_MAX;
+			for_each_possible_cpu(cpu) {
+				s = per_cpu_ptr(pf->shards, cpu);
+				if (kfifo_peek(&s->fifo, &head) && head.ts < best_ts) {
+					best = s;
+					best_ts = head.ts;
+				}
+			}
+			if (!best || !kfifo_get(&best->fifo, &ev[got]))
+				break;
+			got++;
+		}
+	}
+	spin_unlock_bh(&pf->drain_lock);
+	return got;
+}
+EXPORT_SYMBOL_GPL(pcpu_fifo_drain);
+
+bool pcpu_fifo_empty(struct pcpu_fifo *pf)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		if (!kfifo_is_empty(&per_cpu_ptr(pf->shards, cpu)->fifo))
+			return false;
+	return true;
+}
+EXPORT_SYMBOL_GPL(pcpu_fifo_empty);
+
+unsigned long pcpu_fifo_dropped(struct pcpu_fifo *pf)
+{
+	unsigned long sum = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		sum += READ_ONCE(per_cpu_ptr(pf->shards, cpu)->dropped);
+	return sum;
+}
+EXPORT_SYMBOL_GPL(pcpu_fifo_dropped);
+
+/*
+ * The char device
+ */
+static unsigned int events_per_cpu = 4096;	/* rounded up to a power of two */
+module_param(events_per_cpu, uint, 0444);
+
+static bool merge;				/* read() in timestamp order */
+module_param(merge, bool, 0644);
+
+#define DRAIN_BATCH 64
+
+static struct pcpu_fifo *dev_fifo;
+
+static ssize_t pcpu_read(struct file *file, char __user *buf, size_t count,
+			 loff_t *ppos)
+{
+	unsigned int want = min_t(size_t, count / sizeof(struct pcpu_event), DRAIN_BATCH);
+	struct pcpu_event *ev;
+	unsigned int got;
+	ssize_t ret;
+
+	if (!want)
+		return -EINVAL;
+	ev = kmalloc_array(want, sizeof(*ev), GFP_KERNEL);
+	if (!ev)
+		return -ENOMEM;
+
+	/* Another reader may drain what woke us up; wait again if so */
+	while (!(got = pcpu_fifo_drain(dev_fifo, ev, want, READ_ONCE(merge)))) {
+		if (file->f_flags & O_NONBLOCK) {
+			ret = -EAGAIN;
+			goto out;
+		}
+		if (wait_event_interruptible(dev_fifo->wq, !pcpu_fifo_empty(dev_fifo))) {
+			ret = -ERESTARTSYS;
+			goto out;
+		}
+	}
+
+	ret = got * sizeof(*ev);
+	if (copy_to_user(buf, ev, ret))
+		ret = -EFAULT;
+out:
+	kfree(ev);
+	return ret;
+}
+
+static ssize_t pcpu_write(struct file *file, const char __user *buf,
+			  size_t count, loff_t *ppos)
+{
+	char chunk[PCPU_EVENT_DATA];
+	size_t done = 0, n;
+
+	/* Longer writes are split into several events */
+	while (done < count) {
+		n = min_t(size_t, count - done, PCPU_EVENT_DATA);
+		if (copy_from_user(chunk, buf + done, n))
+			return done ? done : -EFAULT;
+		if (pcpu_fifo_push(dev_fifo, chunk, n))
+			return done ? done : -ENOSPC;
+		done += n;
+	}
+	return done;
+}
+
+static __poll_t pcpu_poll(struct file *file, poll_table *wait)
+{
+	poll_wait(file, &dev_fifo->wq, wait);
+	return EPOLLOUT | EPOLLWRNORM |
+	       (pcpu_fifo_empty(dev_fifo) ? 0 : EPOLLIN | EPOLLRDNORM);
+}
+
+static const struct file_operations pcpu_fops = {
+	.owner		= THIS_MODULE,
+	.read		= pcpu_read,
+	.write		= pcpu_write,
+	.poll		= pcpu_poll,
+	.llseek		= noop_llseek,
+};
+
+static struct miscdevice pcpu_misc = {
+	.minor		= MISC_DYNAMIC_MINOR,
+	.name		= "kfifo_percpu",
+	.fops		= &pcpu_fops,
+};
+
+static int pcpu_init(void)
+{
+	int ret;
+
+	dev_fifo = pcpu_fifo_create(events_per_cpu);
+	if (!dev_fifo)
+		return -ENOMEM;
+	ret = misc_register(&pcpu_misc);
+	if (ret)
+		pcpu_fifo_destroy(dev_fifo);
+	return ret;
+}
+
+static void pcpu_exit(void)
+{
+	misc_deregister(&pcpu_misc);
+	printk(KERN_INFO "kfifo_percpu: %lu events dropped\n",
+	       pcpu_fifo_dropped(dev_fifo));
+	pcpu_fifo_destroy(dev_fifo);
+}
+
+module_init(pcpu_init);
+module_exit(pcpu_exit);
@@ -0,0 +1,35 @@
+/*
+ * kfifo_percpu.h -- multi-producer event fifo sharded per CPU
+ */
+
+#ifndef _KFIFO_PERCPU_H
+#define _KFIFO_PERCPU_H
+
+#include <linux/types.h>
+
+#define PCPU_EVENT_DATA	48
+
+/*
+ * One event, as stored in the shards and as returned by read() on
+ * /dev/kfifo_percpu. 64 bytes, so an event never straddles two lines.
+ */
+struct pcpu_event {
+	__u64 ts;		/* ktime_get_ns() at push time */
+	__u32 cpu;		/* shard it was pushed to */
+	__u32 len;		/* valid bytes in data */
+	__u8 data[PCPU_EVENT_DATA];
+};
+
+#ifdef __KERNEL__
+struct pcpu_fifo;
+
+struct pcpu_fifo *pcpu_fifo_create(unsigned int events_per_cpu);
+void pcpu_fifo_destroy(struct pcpu_fifo *pf);
+int pcpu_fifo_push(struct pcpu_fifo *pf, const void *data, unsigned int len);
+unsigned int pcpu_fifo_drain(struct pcpu_fifo *pf, struct pcpu_event *ev,
+			     unsigned int n, bool merge);
+bool pcpu_fifo_empty(struct pcpu_fifo *pf);
+unsigned long pcpu_fifo_dropped(struct pcpu_fifo *pf);
+#endif
+
+#endif /* _KFIFO_PERCPU_H */
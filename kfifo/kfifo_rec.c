@@ -0,0 +1,198 @@
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/kfifo.h>
+#include <linux/fs.h>
+#include <linux/miscdevice.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/uaccess.h>
+
+#include "kfifo_rec.h"
+
+MODULE_LICENSE("Dual BSD/GPL");
+
+/*
+ * /dev/kfifo_rec: a message queue on top of record kfifos.
+ *
+ * Every write() is stored as one record and every read() returns
+ * exactly one, so userspace needs no framing of its own. There is one
+ * fifo per priority level and readers always drain the highest
+ * non-empty one first, so urgent control messages overtake bulk data.
+ * A record that doesn't fit the reader's buffer is left in the fifo and
+ * the read fails with -EMSGSIZE.
+ */
+
+//Declaration
+#define REC_FIFO_SIZE	(64 * 1024)	/* per priority, must be a power of two */
+#define REC_MAX		(REC_FIFO_SIZE / 4)
+
+static STRUCT_KFIFO_REC_2(REC_FIFO_SIZE) fifos[KFIFO_REC_NR_PRIO];
+
+/*
+ * One reader and one writer per fifo need no locking with kfifo, so
+ * readers share read_lock and writers of each priority share the
+ * matching write_lock; the two sides never contend.
+ */
+static DEFINE_MUTEX(read_lock);
+static struct mutex write_lock[KFIFO_REC_NR_PRIO];
+static DECLARE_WAIT_QUEUE_HEAD(read_wq);
+static DECLARE_WAIT_QUEUE_HEAD(write_wq);
+
+static bool rec_any(void)
+{
+	int p;
+
+	for (p = 0; p < KFIFO_REC_NR_PRIO; p++)
+		if (!kfifo_is_empty(&fifos[p]))
+			return true;
+	return false;
+}
+
+static int rec_open(struct inode *inode, struct file *file)
+{
+	file->private_data = (void *)(long)KFIFO_REC_PRIO_NORMAL;
+	return 0;
+}
+
+static ssize_t rec_read(struct file *file, char __user *buf, size_t count,
+			loff_t *ppos)
+{
+	unsigned int copied;
+	int p, ret;
+
+	if (mutex_lock_interruptible(&read_lock))
+		return -ERESTARTSYS;
+
+	while (!rec_any()) {
+		mutex_unlock(&read_lock);
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		if (wait_event_interruptible(read_wq, rec_any()))
+			return -ERESTARTSYS;
+		if (mutex_lock_interruptible(&read_lock))
+			return -ERESTARTSYS;
+	}
+
+	for (p = KFIFO_REC_NR_PRIO - 1; kfifo_is_empty(&fifos[p]); p--)
+		;
+	if (kfifo_peek_len(&fifos[p]) > count) {
+		mutex_unlock(&read_lock);
+		return -EMSGSIZE;
+	}
+	ret = kfifo_to_user(&fifos[p], buf, count, &copied);
+	mutex_unlock(&read_lock);
+
+	wake_up_interruptible(&write_wq);
+	return ret ? ret : copied;
+}
+
+static ssize_t rec_write(struct file *file, const char __user *buf,
+			 size_t count, loff_t *ppos)
+{
+	int p = (long)file->private_data;
+	unsigned int copied;
+	int ret;
+
+	if (!count)
+		return 0;
+	if (count > REC_MAX)
+		return -EMSGSIZE;
+
+	if (mutex_lock_interruptible(&write_lock[p]))
+		return -ERESTARTSYS;
+
+	/* For record fifos kfifo_avail() is the largest record that fits */
+	while (kfifo_avail(&fifos[p]) < count) {
+		mutex_unlock(&write_lock[p]);
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		if (wait_event_interruptible(write_wq, kfifo_avail(&fifos[p]) >= count))
+			return -ERESTARTSYS;
+		if (mutex_lock_interruptible(&write_lock[p]))
+			return -ERESTARTSYS;
+	}
+
+	ret = kfifo_from_user(&fifos[p], buf, count, &copied);
+	mutex_unlock(&write_lock[p]);
+	if (ret)
+		return ret;
+
+	wake_up_interruptible(&read_wq);
+	return count;
+}
+
+static __poll_t rec_poll(struct file *file, poll_table *wait)
+{
+	int p = (long)file->private_data;
+	__poll_t mask = 0;
+
+	poll_wait(file, &read_wq, wait);
+	poll_wait(file, &write_wq, wait);
+
+	if (rec_any())
+		mask |= EPOLLIN | EPOLLRDNORM;
+	/*
+	 * Writable only when a record of the largest allowed size,
+	 * REC_MAX, fits, so any write() after EPOLLOUT goes through
+	 * without blocking. kfifo_avail() already accounts for the
+	 * record header.
+	 */
+	if (kfifo_avail(&fifos[p]) >= REC_MAX)
+		mask |= EPOLLOUT | EPOLLWRNORM;
+	return mask;
+}
+
+static long rec_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	int p;
+
+	switch (cmd) {
+	case KFIFO_REC_SET_PRIO:
+		if (get_user(p, (int __user *)arg))
+			return -EFAULT;
+		if (p < 0 || p >= KFIFO_REC_NR_PRIO)
+			return -EINVAL;
+		file->private_data = (void *)(long)p;
+		return 0;
+	case KFIFO_REC_GET_PRIO:
+		return put_user((int)(long)file->private_data, (int __user *)arg);
+	default:
+		return -ENOTTY;
+	}
+}
+
+static const struct file_operations rec_fops = {
+	.owner		= THIS_MODULE,
+	.open		= rec_open,
+	.read		= rec_read,
+	.write		= rec_write,
+	.poll		= rec_poll,
+	.unlocked_ioctl	= rec_ioctl,
+	.llseek		= noop_llseek,
+};
+
+static struct miscdevice rec_misc = {
+	.minor		= MISC_DYNAMIC_MINOR,
+	.name		= "kfifo_rec",
+	.fops		= &rec_fops,
+};
+
+static int rec_init(void)
+{
+	int p;
+
+	for (p = 0; p < KFIFO_REC_NR_PRIO; p++) {
+		INIT_KFIFO(fifos[p]);
+		mutex_init(&write_lock[p]);
+	}
+	return misc_register(&rec_misc);
+}
+
+static void rec_exit(void)
+{
+	misc_deregister(&rec_misc);
+}
+
+module_init(rec_init);
+module_exit(rec_exit);
@@ -0,0 +1,25 @@
+/*
+ * kfifo_rec.h -- ioctl interface of /dev/kfifo_rec
+ */
+
+#ifndef _KFIFO_REC_H
+#define _KFIFO_REC_H
+
+#include <linux/ioctl.h>
+
+/*
+ * Each open file writes at one priority, KFIFO_REC_PRIO_NORMAL unless
+ * changed. Reads always return the oldest record of the highest
+ * priority that has any.
+ */
+#define KFIFO_REC_PRIO_BULK	0
+#define KFIFO_REC_PRIO_NORMAL	1
+#define KFIFO_REC_PRIO_HIGH	2
+#define KFIFO_REC_PRIO_URGENT	3
+#define KFIFO_REC_NR_PRIO	4
+
+#define KFIFO_REC_IOC_MAGIC	'k'
+#define KFIFO_REC_SET_PRIO	_IOW(KFIFO_REC_IOC_MAGIC, 1, int)
+#define KFIFO_REC_GET_PRIO	_IOR(KFIFO_REC_IOC_MAGIC, 2, int)
+
+#endif /* _KFIFO_REC_H */
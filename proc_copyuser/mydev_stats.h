@@ -0,0 +1,41 @@
+/*
+ * mydev_stats.h -- binary counters of /proc/mydev, shared with userspace
+ */
+
+#ifndef _MYDEV_STATS_H
+#define _MYDEV_STATS_H
+
+#include <linux/types.h>
+
+#define MYDEV_STATS_MAGIC	0x6d796473	/* "myds" */
+#define MYDEV_STATS_VERSION	1
+
+/*
+ * /proc/mydev_stats is one page holding this struct; mmap it read-only
+ * at offset 0 (or read() it). The kernel makes seq odd while it
+ * updates the counters, so a consistent sample is
+ *
+ *	do {
+ *		seq = __atomic_load_n(&st->seq, __ATOMIC_ACQUIRE);
+ *		copy = *st;
+ *		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+ *	} while ((seq & 1) || __atomic_load_n(&st->seq, __ATOMIC_RELAXED) != seq);
+ *
+ * Fields are only ever appended; check version and size before using
+ * any field newer than what the agent was built against.
+ */
+struct mydev_stats {
+	__u32 magic;
+	__u16 version;
+	__u16 size;		/* sizeof(struct mydev_stats) */
+	__u32 seq;
+	__u32 __pad;
+	__u64 opens;
+	__u64 reads;		/* read() calls that started a pass */
+	__u64 writes;
+	__u64 bytes_written;
+	__u64 content_len;	/* current size of /proc/mydev */
+	__u64 last_write_ns;	/* CLOCK_MONOTONIC */
+};
+
+#endif /* _MYDEV_STATS_H */
@@ -2,70 +2,338 @@
 #include <linux/kernel.h>
 #include <linux/module.h>
 #include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/rcupdate.h>
+#include <linux/kref.h>
+#include <linux/mutex.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/overflow.h>
+#include <linux/spinlock.h>
+#include <linux/ktime.h>
 #include <linux/uaccess.h>
+#include <linux/fs.h>
+#include <linux/version.h>
+
+#include "../evtrace/evtrace.h"
+#include "mydev_stats.h"
+
+/* vm_flags became read-only in 6.3 */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,3,0)
+#define mydev_vm_flags_mod(vma, set, clear) vm_flags_mod(vma, set, clear)
+#else
+#define mydev_vm_flags_mod(vma, set, clear) \
+	((vma)->vm_flags = ((vma)->vm_flags & ~(clear)) | (set))
+#endif
+
+/*
+ * /proc/mydev holds whatever was last written to it, up to max_size
+ * bytes. A write at offset 0 replaces the contents and writes further
+ * on extend them, so "cat file > /proc/mydev" works for large files.
+ *
+ * The contents are an immutable snapshot published through an RCU
+ * pointer. A writer builds a new snapshot under state_lock and swaps it
+ * in; every open() takes a reference to the snapshot current at that
+ * moment, under rcu_read_lock() only, and seq_file serves reads of any
+ * size and offset from it. Readers never block the writer or each
+ * other and each one sees a consistent copy until it closes the file.
+ */
+static unsigned int max_size = 1024 * 1024;
+module_param(max_size, uint, 0444);
+
+#define MYDEV_CHUNK	PAGE_SIZE	/* bytes per seq_file record */
+
+struct mydev_state {
+	struct kref ref;
+	struct rcu_head rcu;
+	size_t len;
+	char data[];
+};
 
 static struct proc_dir_entry *entry;
-static char userArray[128] = "Microchip Technology\n";
-int len = 1;
+static struct mydev_state __rcu *state;
+static DEFINE_MUTEX(state_lock);
 
+/*
+ * /proc/mydev_stats: the counters live in one zeroed page that agents
+ * mmap read-only and sample with plain loads, see mydev_stats.h. The
+ * sequence count sits in the page itself, so it is a bare u32 bumped
+ * by hand rather than a seqcount_t, whose layout depends on the kernel
+ * config. Updaters are serialized by stats_lock.
+ */
+static struct proc_dir_entry *stats_entry;
+static struct mydev_stats *stats;
+static DEFINE_SPINLOCK(stats_lock);
 
-//open
-int proc_open(struct inode *node, struct file *flip)
+static unsigned long stats_begin(void)
 {
-	printk(KERN_INFO "Proc Open function\n");
-	return 0;
+	unsigned long flags;
+
+	spin_lock_irqsave(&stats_lock, flags);
+	WRITE_ONCE(stats->seq, stats->seq + 1);
+	smp_wmb();
+	return flags;
 }
 
-//read
-ssize_t proc_read(struct file *flip, char *buf, size_t count, loff_t *f_pos)
+static void stats_end(unsigned long flags)
 {
-	printk(KERN_INFO "Proc read function\n");
+	smp_wmb();
+	WRITE_ONCE(stats->seq, stats->seq + 1);
+	spin_unlock_irqrestore(&stats_lock, flags);
+}
 
-	if(len)
-	{
-		len = 0;
-	}
-	else
-	{
-		len = 1;
-		return 0;
+static struct mydev_state *state_alloc(size_t len)
+{
+	struct mydev_state *s;
+
+	s = kvmalloc(struct_size(s, data, len), GFP_KERNEL);
+	if (!s)
+		return NULL;
+	kref_init(&s->ref);
+	s->len = len;
+	return s;
+}
+
+static void state_free_rcu(struct rcu_head *rcu)
+{
+	kvfree(container_of(rcu, struct mydev_state, rcu));
+}
+
+/* Readers may still be trying kref_get_unless_zero() under RCU */
+static void state_release(struct kref *ref)
+{
+	call_rcu(&container_of(ref, struct mydev_state, ref)->rcu, state_free_rcu);
+}
+
+static void state_put(struct mydev_state *s)
+{
+	kref_put(&s->ref, state_release);
+}
+
+static struct mydev_state *state_get(void)
+{
+	struct mydev_state *s;
+
+	rcu_read_lock();
+	do {
+		s = rcu_dereference(state);
+	} while (!kref_get_unless_zero(&s->ref));
+	rcu_read_unlock();
+	return s;
+}
+
+/*
+ * seq_file iterator: record n is the n-th MYDEV_CHUNK of the snapshot,
+ * so the contents are generated piecewise however large they are.
+ */
+static void *mydev_start(struct seq_file *m, loff_t *pos)
+{
+	struct mydev_state *s = m->private;
+
+	evtrace("Proc read function\n");
+	if (!*pos) {
+		unsigned long flags = stats_begin();
+
+		stats->reads++;
+		stats_end(flags);
 	}
+	if (*pos >= DIV_ROUND_UP(s->len, MYDEV_CHUNK))
+		return NULL;
+	return s->data + *pos * MYDEV_CHUNK;
+}
+
+static void *mydev_next(struct seq_file *m, void *v, loff_t *pos)
+{
+	++*pos;
+	return mydev_start(m, pos);
+}
 
-	copy_to_user(buf, userArray, 128);
-	return count;
+static void mydev_stop(struct seq_file *m, void *v)
+{
+}
+
+static int mydev_show(struct seq_file *m, void *v)
+{
+	struct mydev_state *s = m->private;
+	char *p = v;
+
+	seq_write(m, p, min_t(size_t, MYDEV_CHUNK, s->data + s->len - p));
+	return 0;
+}
+
+static const struct seq_operations mydev_sops = {
+	.start	= mydev_start,
+	.next	= mydev_next,
+	.stop	= mydev_stop,
+	.show	= mydev_show,
+};
+
+//open: pins the current snapshot for the lifetime of the file
+int proc_open(struct inode *node, struct file *flip)
+{
+	unsigned long flags;
+	int ret;
+
+	evtrace("Proc Open function\n");
+	flags = stats_begin();
+	stats->opens++;
+	stats_end(flags);
+	ret = seq_open(flip, &mydev_sops);
+	if (!ret)
+		((struct seq_file *)flip->private_data)->private = state_get();
+	return ret;
 }
 
 //write
-ssize_t proc_write(struct file *flip, const char *buf, size_t count, loff_t *f_pos)
+ssize_t proc_write(struct file *flip, const char __user *buf, size_t count, loff_t *f_pos)
 {
-	printk(KERN_INFO "Proc write function\n");
-	copy_from_user(userArray, buf, count);
-	return count;
+	struct mydev_state *old, *new;
+	unsigned long flags;
+	size_t keep;
+	ssize_t ret;
+
+	evtrace("Proc write function\n");
+	if (*f_pos < 0 || *f_pos >= max_size)
+		return count ? -EFBIG : 0;
+	count = min_t(size_t, count, max_size - *f_pos);
+
+	if (mutex_lock_interruptible(&state_lock))
+		return -ERESTARTSYS;
+	old = rcu_dereference_protected(state, lockdep_is_held(&state_lock));
+	keep = min_t(size_t, *f_pos, old->len);
+
+	ret = -ENOMEM;
+	new = state_alloc(keep + count);
+	if (!new)
+		goto unlock;
+	memcpy(new->data, old->data, keep);
+	if (copy_from_user(new->data + keep, buf, count)) {
+		kvfree(new);
+		ret = -EFAULT;
+		goto unlock;
+	}
+
+	rcu_assign_pointer(state, new);
+	state_put(old);
+	flags = stats_begin();
+	stats->writes++;
+	stats->bytes_written += count;
+	stats->content_len = new->len;
+	stats->last_write_ns = ktime_get_ns();
+	stats_end(flags);
+	*f_pos = keep + count;
+	ret = count;
+unlock:
+	mutex_unlock(&state_lock);
+	return ret;
 }
 
 //release
 int proc_release(struct inode *node, struct file *flip)
 {
-	printk(KERN_INFO "Proc close function\n");
-	return 0;
+	evtrace("Proc close function\n");
+	state_put(((struct seq_file *)flip->private_data)->private);
+	return seq_release(node, flip);
 }
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,6,0)
+static const struct proc_ops memory_fops = {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,10,0)
+	.proc_read_iter = seq_read_iter,	/* also gives splice()/sendfile() */
+#else
+	.proc_read = seq_read,
+#endif
+	.proc_write = proc_write,
+	.proc_lseek = seq_lseek,
+	.proc_open = proc_open,
+	.proc_release = proc_release
+};
+#else
 static struct file_operations memory_fops = {
-	read: proc_read,
+	read: seq_read,
 	write: proc_write,
+	llseek: seq_lseek,
 	open: proc_open,
 	release: proc_release
 };
+#endif
+
+static int stats_mmap(struct file *flip, struct vm_area_struct *vma)
+{
+	if (vma->vm_pgoff || vma->vm_end - vma->vm_start > PAGE_SIZE)
+		return -EINVAL;
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	mydev_vm_flags_mod(vma, VM_DONTEXPAND | VM_DONTDUMP, VM_MAYWRITE);
+	/* Takes a page reference, so a mapping may outlive the module */
+	return vm_insert_page(vma, vma->vm_start, virt_to_page(stats));
+}
+
+//read: a consistent copy of the counters, for callers that don't mmap
+ssize_t stats_read(struct file *flip, char __user *buf, size_t count, loff_t *f_pos)
+{
+	struct mydev_stats copy;
+	unsigned long flags;
+
+	spin_lock_irqsave(&stats_lock, flags);
+	copy = *stats;
+	spin_unlock_irqrestore(&stats_lock, flags);
+	return simple_read_from_buffer(buf, count, f_pos, &copy, sizeof(copy));
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,6,0)
+static const struct proc_ops stats_fops = {
+	.proc_read = stats_read,
+	.proc_mmap = stats_mmap,
+	.proc_lseek = default_llseek
+};
+#else
+static struct file_operations stats_fops = {
+	read: stats_read,
+	mmap: stats_mmap,
+	llseek: default_llseek
+};
+#endif
 
 //driver init function
 static int driver_init(void)
 {
+	static const char initial[] = "Microchip Technology\n";
+	struct mydev_state *s;
+
 	printk(KERN_INFO "Proc_fs driver init function\n");
 
+	stats = (struct mydev_stats *)get_zeroed_page(GFP_KERNEL);
+	if (!stats)
+		return -ENOMEM;
+	stats->magic = MYDEV_STATS_MAGIC;
+	stats->version = MYDEV_STATS_VERSION;
+	stats->size = sizeof(*stats);
+
+	s = state_alloc(sizeof(initial) - 1);
+	if (!s)
+		goto err_stats;
+	memcpy(s->data, initial, s->len);
+	RCU_INIT_POINTER(state, s);
+	stats->content_len = s->len;
+
 	//create the proc fs entry
 	entry = proc_create("mydev", 0666, NULL, &memory_fops);
+	if (!entry)
+		goto err_state;
+	stats_entry = proc_create("mydev_stats", 0444, NULL, &stats_fops);
+	if (!stats_entry)
+		goto err_entry;
 
 	return 0;
+
+err_entry:
+	proc_remove(entry);
+err_state:
+	kvfree(s);
+err_stats:
+	free_page((unsigned long)stats);
+	return -ENOMEM;
 }
 
 //driver exit function
@@ -73,10 +341,17 @@ static void driver_exit(void)
 {
 	printk(KERN_INFO "Proc_fs driver exit function\n");
 
+	/* No file can be open once the entry is gone */
+	proc_remove(stats_entry);
+	proc_remove(entry);
+	state_put(rcu_dereference_protected(state, 1));
+	rcu_barrier();
+	/* Mappings still around keep the page until they go away */
+	free_page((unsigned long)stats);
 }
 
 module_init(driver_init);
 module_exit(driver_exit);
 
+MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Arun R");
-
@@ -3,34 +3,36 @@
 #include <linux/module.h>
 #include <linux/proc_fs.h>
 
+#include "../evtrace/evtrace.h"
+
 static struct proc_dir_entry *entry;
 
 
 //open
 int proc_open(struct inode *node, struct file *flip)
 {
-	printk(KERN_INFO "Proc Open function\n");
+	evtrace("Proc Open function\n");
 	return 0;
 }
 
 //read
 ssize_t proc_read(struct file *flip, char *buf, size_t count, loff_t *f_pos)
 {
-	printk(KERN_INFO "Proc read function\n");
+	evtrace("Proc read function\n");
 	return 0;
 }
 
 //write
 ssize_t proc_write(struct file *flip, const char *buf, size_t count, loff_t *f_pos)
 {
-	printk(KERN_INFO "Proc write function\n");
+	evtrace("Proc write function\n");
 	return count;
 }
 
 //release
 int proc_release(struct inode *node, struct file *flip)
 {
-	printk(KERN_INFO "Proc close function\n");
+	evtrace("Proc close function\n");
 	return 0;
 }
 
@@ -62,5 +64,6 @@ static void driver_exit(void)
 module_init(driver_init);
 module_exit(driver_exit);
 
+MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Arun R");
 
@@ -33,6 +33,8 @@
 #include <linux/tcp.h>         /* struct tcphdr */
 #include <linux/skbuff.h>
 #include <linux/version.h> 	/* LINUX_VERSION_CODE  */
+#include <linux/ethtool.h>
+#include <linux/ktime.h>
 
 #include "snull.h"
 
@@ -58,6 +60,7 @@ module_param(timeout, int, 0);
 struct snull_packet {
 	struct snull_packet *next;
 	struct net_device *dev;
+	unsigned long stamp;	/* jiffies when queued to the peer */
 	int	datalen;
 	u8 data[ETH_DATA_LEN];
 };
@@ -65,6 +68,18 @@ struct snull_packet {
 int pool_size = 8;
 module_param(pool_size, int, 0);
 
+/*
+ * Transmit timeout recovery accounting, reported through ethtool -S.
+ */
+struct snull_recovery {
+	u64 count;
+	u64 reclaimed;		/* stuck in-flight buffers given back */
+	u64 refilled;		/* buffers allocated to top the pool up */
+	u64 last_ns;
+	u64 max_ns;
+	u64 total_ns;
+};
+
 /*
  * This structure is private to each device. It is used to pass
  * packets in and out, so there is place for a packet
@@ -74,6 +89,7 @@ struct snull_priv {
 	struct net_device_stats stats;
 	int status;
 	struct snull_packet *ppool;
+	int pool_count;			/* free buffers in ppool */
 	struct snull_packet *rx_queue;  /* List of incoming packets */
 	int rx_int_enabled;
 	int tx_packetlen;
@@ -81,6 +97,7 @@ struct snull_priv {
 	spinlock_t lock;
 	struct net_device *dev;
 	bool wol;
+	struct snull_recovery recovery;
 };
 
 /*
@@ -102,6 +119,7 @@ void snull_setup_pool(struct net_device *dev)
 		pkt->dev = dev;
 		pkt->next = priv->ppool;
 		priv->ppool = pkt;
+		priv->pool_count++;
 	}
 }
 
@@ -112,6 +130,7 @@ void snull_teardown_pool(struct net_device *dev)
     
 	while ((pkt = priv->ppool)) {
 		priv->ppool = pkt->next;
+		priv->pool_count--;
 		kfree (pkt);
 		/* FIXME - in-flight packets ? */
 	}
@@ -130,9 +149,11 @@ struct snull_packet *snull_get_tx_buffer(struct net_device *dev)
 	pkt = priv->ppool;
 	if(!pkt) {
 		PDEBUG("Out of Pool\n");
+		spin_unlock_irqrestore(&priv->lock, flags);
 		return pkt;
 	}
 	priv->ppool = pkt->next;
+	priv->pool_count--;
 	if (priv->ppool == NULL) {
 		printk (KERN_INFO "Pool empty\n");
 		netif_stop_queue(dev);
@@ -148,8 +169,18 @@ void snull_release_buffer(struct snull_packet *pkt)
 	struct snull_priv *priv = netdev_priv(pkt->dev);
 	
 	spin_lock_irqsave(&priv->lock, flags);
+	/*
+	 * A buffer replaced by snull_refill_pool() while it was stuck
+	 * comes back as a surplus; don't let the pool grow past pool_size.
+	 */
+	if (priv->pool_count >= pool_size) {
+		spin_unlock_irqrestore(&priv->lock, flags);
+		kfree(pkt);
+		return;
+	}
 	pkt->next = priv->ppool;
 	priv->ppool = pkt;
+	priv->pool_count++;
 	spin_unlock_irqrestore(&priv->lock, flags);
 	if (netif_queue_stopped(pkt->dev) && pkt->next == NULL)
 		netif_wake_queue(pkt->dev);
@@ -160,6 +191,7 @@ void snull_enqueue_buf(struct net_device *dev, struct snull_packet *pkt)
 	unsigned long flags;
 	struct snull_priv *priv = netdev_priv(dev);
 
+	pkt->stamp = jiffies;
 	spin_lock_irqsave(&priv->lock, flags);
 	pkt->next = priv->rx_queue;  /* FIXME - misorders packets */
 	priv->rx_queue = pkt;
@@ -399,6 +431,67 @@ int snull_tx(struct sk_buff *skb, struct net_device *dev)
 	return 0; /* Our simple device can not fail */
 }
 
+/*
+ * Give back the buffers of ours that have been sitting in the peer's
+ * receive queue for longer than a watchdog period. Packets that are
+ * merely in flight are left alone.
+ */
+static int snull_reclaim_stuck(struct net_device *dev)
+{
+	struct net_device *peer = snull_devs[dev == snull_devs[0] ? 1 : 0];
+	struct snull_priv *ppriv = netdev_priv(peer);
+	struct snull_packet **pp, *pkt, *stuck = NULL;
+	unsigned long flags;
+	int n = 0;
+
+	spin_lock_irqsave(&ppriv->lock, flags);
+	pp = &ppriv->rx_queue;
+	while ((pkt = *pp)) {
+		if (pkt->dev == dev &&
+		    time_after(jiffies, pkt->stamp + dev->watchdog_timeo)) {
+			*pp = pkt->next;
+			pkt->next = stuck;
+			stuck = pkt;
+			n++;
+		} else
+			pp = &pkt->next;
+	}
+	spin_unlock_irqrestore(&ppriv->lock, flags);
+
+	while ((pkt = stuck)) {
+		stuck = pkt->next;
+		snull_release_buffer(pkt);
+	}
+	return n;
+}
+
+/*
+ * Top the free pool back up to pool_size, one buffer at a time, so
+ * transmission can go on while buffers are still stuck in flight. When
+ * those come back the surplus is freed by snull_release_buffer().
+ */
+static int snull_refill_pool(struct net_device *dev)
+{
+	struct snull_priv *priv = netdev_priv(dev);
+	struct snull_packet *pkt;
+	unsigned long flags;
+	int n = 0;
+
+	while (READ_ONCE(priv->pool_count) < pool_size) {
+		pkt = kmalloc(sizeof(struct snull_packet), GFP_ATOMIC);
+		if (!pkt)
+			break;
+		pkt->dev = dev;
+		spin_lock_irqsave(&priv->lock, flags);
+		pkt->next = priv->ppool;
+		priv->ppool = pkt;
+		priv->pool_count++;
+		spin_unlock_irqrestore(&priv->lock, flags);
+		n++;
+	}
+	return n;
+}
+
 /**
 * Deal with a transmit timeout.
 * See https://github.com/torvalds/linux/commit/0290bd291cc0e0488e35e66bf39efcd7d9d9122b
@@ -412,21 +505,42 @@ void snull_tx_timeout (struct net_device *dev, unsigned int txqueue)
 {
 	struct snull_priv *priv = netdev_priv(dev);
         struct netdev_queue *txq = netdev_get_tx_queue(dev, 0);
+	struct snull_recovery *rec = &priv->recovery;
+	unsigned long flags;
+	int reclaimed, refilled;
+	u64 start, delta;
 
+	start = ktime_get_ns();
 	PDEBUG("Transmit timeout at %ld, latency %ld\n", jiffies,
 			jiffies - txq->trans_start);
-        /* Simulate a transmission interrupt to get things moving */
-	priv->status |= SNULL_TX_INTR;
-	snull_regular_interrupt(0, dev, NULL);
+	/*
+	 * Deliver the transmit-done interrupt that went missing, if any,
+	 * to get things moving. If it has already been handled (the skb
+	 * is gone), don't free it a second time.
+	 */
+	if (priv->status & SNULL_TX_INTR)
+		snull_regular_interrupt(0, dev, NULL);
 	priv->stats.tx_errors++;
 
-	/* Reset packet pool */
-	spin_lock(&priv->lock);
-	snull_teardown_pool(dev);
-	snull_setup_pool(dev);
-	spin_unlock(&priv->lock);
+	/* Recover the pool incrementally instead of rebuilding it */
+	reclaimed = snull_reclaim_stuck(dev);
+	refilled = snull_refill_pool(dev);
+
+	spin_lock_irqsave(&priv->lock, flags);
+	delta = ktime_get_ns() - start;
+	rec->count++;
+	rec->reclaimed += reclaimed;
+	rec->refilled += refilled;
+	rec->last_ns = delta;
+	rec->total_ns += delta;
+	if (delta > rec->max_ns)
+		rec->max_ns = delta;
+	if (priv->ppool)
+		netif_wake_queue(dev);
+	spin_unlock_irqrestore(&priv->lock, flags);
 
-	netif_wake_queue(dev);
+	PDEBUG("Recovered in %llu ns: %i reclaimed, %i refilled\n",
+			delta, reclaimed, refilled);
 	return;
 }
 
@@ -586,11 +700,55 @@ static int snull_set_wol(struct net_device *dev, struct ethtool_wolinfo *wol)
 	return 0;
 }
 
+static const char snull_gstrings_stats[][ETH_GSTRING_LEN] = {
+	"tx_timeouts",
+	"tx_reclaimed",
+	"pool_refilled",
+	"recovery_last_ns",
+	"recovery_max_ns",
+	"recovery_total_ns",
+};
+
+#define SNULL_STATS_LEN ARRAY_SIZE(snull_gstrings_stats)
+
+static int snull_get_sset_count(struct net_device *dev, int sset)
+{
+	if (sset == ETH_SS_STATS)
+		return SNULL_STATS_LEN;
+	return -EOPNOTSUPP;
+}
+
+static void snull_get_strings(struct net_device *dev, u32 sset, u8 *data)
+{
+	if (sset == ETH_SS_STATS)
+		memcpy(data, snull_gstrings_stats, sizeof(snull_gstrings_stats));
+}
+
+static void snull_get_ethtool_stats(struct net_device *dev,
+				    struct ethtool_stats *stats, u64 *data)
+{
+	struct snull_priv *priv = netdev_priv(dev);
+	struct snull_recovery *rec = &priv->recovery;
+	unsigned long flags;
+
+	spin_lock_irqsave(&priv->lock, flags);
+	data[0] = rec->count;
+	data[1] = rec->reclaimed;
+	data[2] = rec->refilled;
+	data[3] = rec->last_ns;
+	data[4] = rec->max_ns;
+	data[5] = rec->total_ns;
+	spin_unlock_irqrestore(&priv->lock, flags);
+}
+
 static const struct ethtool_ops snull_ethtool_ops = {
         .get_link               = ethtool_op_get_link,
         .get_ts_info            = ethtool_op_get_ts_info,
 	.set_wol		= snull_set_wol,
 	.get_wol		= snull_get_wol,
+	.get_sset_count		= snull_get_sset_count,
+	.get_strings		= snull_get_strings,
+	.get_ethtool_stats	= snull_get_ethtool_stats,
 };
 
 static const struct header_ops snull_header_ops = {
@@ -5,38 +5,315 @@
 #include <linux/slab.h>
 #include <linux/timer.h>
 #include <linux/jiffies.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/smp.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/math64.h>
+#include <linux/version.h>
 #include <asm/param.h>
 
+#include "../evtrace/evtrace.h"
+
 MODULE_LICENSE("Dual BSD/GPL");
 
-struct timer_list exp_timer;
 int delay = 5;
 
+/*
+ * The jiffies timer can run as several instances, to model independent
+ * users of periodic timers. With deferrable set they use
+ * TIMER_DEFERRABLE, so an idle CPU isn't woken for them and they run on
+ * its next wakeup instead. A non-zero slack_ms lets every expiry be
+ * pushed back to the next multiple of slack_ms, which makes instances
+ * with nearby expiries fire on the same tick. Each instance keeps its
+ * nominal schedule (due) so slack and deferral don't add up to drift.
+ *
+ * Avoided wakeups are the expiries that shared a tick with the previous
+ * one plus the periods a deferred instance slept through; both are in
+ * debugfs, timer/wakeups.
+ */
+static unsigned int instances = 1;
+module_param(instances, uint, 0444);
+MODULE_PARM_DESC(instances, "number of periodic jiffies timers");
+
+static unsigned int period_ms = 1000;
+module_param(period_ms, uint, 0444);
+MODULE_PARM_DESC(period_ms, "period of each jiffies timer");
+
+static bool deferrable;
+module_param(deferrable, bool, 0444);
+MODULE_PARM_DESC(deferrable, "don't wake an idle CPU for the jiffies timers");
+
+static unsigned int slack_ms;
+module_param(slack_ms, uint, 0444);
+MODULE_PARM_DESC(slack_ms, "round expiries up to a multiple of this, 0 for exact");
+
+struct timer_inst {
+	struct timer_list timer;
+	unsigned long due;		/* nominal expiry, before slack */
+};
+
+static struct timer_inst *exp_timers;
+static struct dentry *timer_dir;
+
+static DEFINE_SPINLOCK(wakeup_lock);
+static unsigned long last_tick;
+static struct {
+	unsigned long expiries;
+	unsigned long wakeups;
+	unsigned long coalesced;
+	unsigned long skipped;
+} wk;
+
+static unsigned long timer_slack(unsigned long due)
+{
+	unsigned long slack = msecs_to_jiffies(slack_ms);
+
+	if (slack <= 1)
+		return due;
+	return roundup(due, slack);
+}
+
 void do_something(struct timer_list *data)
 {
-	printk("your timer expired and func has been called\n");
+	struct timer_inst *ti = from_timer(ti, data, timer);
+	unsigned long period = msecs_to_jiffies(period_ms);
+	unsigned long now = jiffies;
+	unsigned long skipped = (now - ti->due) / period;
+
+	if (ti == exp_timers)
+		evtrace("your timer expired and func has been called\n");
+
+	spin_lock(&wakeup_lock);
+	wk.expiries++;
+	if (wk.wakeups && now == last_tick) {
+		wk.coalesced++;
+	} else {
+		wk.wakeups++;
+		last_tick = now;
+	}
+	wk.skipped += skipped;
+	spin_unlock(&wakeup_lock);
 
 	//comment the following code, if you need one shot timer.
 	// If not you will get periodic timer
-	mod_timer(&exp_timer, jiffies + msecs_to_jiffies(1000));
-	
+	ti->due += (skipped + 1) * period;
+	mod_timer(&ti->timer, timer_slack(ti->due));
+}
+
+static int wakeups_show(struct seq_file *m, void *v)
+{
+	spin_lock_bh(&wakeup_lock);
+	seq_printf(m, "instances %u period_ms %u slack_ms %u %s\n", instances,
+		   period_ms, slack_ms, deferrable ? "deferrable" : "");
+	seq_printf(m, "expiries %lu wakeups %lu coalesced %lu skipped %lu avoided %lu\n",
+		   wk.expiries, wk.wakeups, wk.coalesced, wk.skipped,
+		   wk.coalesced + wk.skipped);
+	spin_unlock_bh(&wakeup_lock);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(wakeups);
+
+static int jiffies_init(void)
+{
+	unsigned long period = msecs_to_jiffies(period_ms), now = jiffies;
+	unsigned int i;
+
+	if (!instances || !period)
+		return -EINVAL;
+	exp_timers = kcalloc(instances, sizeof(*exp_timers), GFP_KERNEL);
+	if (!exp_timers)
+		return -ENOMEM;
+
+	timer_dir = debugfs_create_dir("timer", NULL);
+	debugfs_create_file("wakeups", 0444, timer_dir, NULL, &wakeups_fops);
+
+	for (i = 0; i < instances; i++) {
+		struct timer_inst *ti = &exp_timers[i];
+
+		timer_setup(&ti->timer, do_something, deferrable ? TIMER_DEFERRABLE : 0);
+		/* Spread the instances over one period, as unrelated users would be */
+		ti->due = now + period + period * i / instances;
+		mod_timer(&ti->timer, timer_slack(ti->due)); //start the timer, if not activated before.
+	}
+	return 0;
+}
+
+/*
+ * High resolution periodic mode, used instead of the jiffies timer when
+ * hr_period_us is set. hrtimer_forward_now() moves the expiry by whole
+ * periods from the previous expiry rather than from "now", so the
+ * period doesn't drift however late a callback runs; periods that were
+ * skipped entirely are counted as overruns. Every expiry's lateness
+ * (callback time minus the start of the hr_slack_us window) goes into
+ * a log2 histogram in debugfs, timer/latency; writing to that file
+ * clears it. An expiry that runs before the end of its slack window was
+ * served by some other interrupt on that CPU, so it is also counted as
+ * coalesced: a wakeup the slack saved.
+ */
+static unsigned int hr_period_us;
+module_param(hr_period_us, uint, 0444);
+MODULE_PARM_DESC(hr_period_us, "hrtimer period in microseconds, 0 for the jiffies timer");
+
+static int hr_cpu = -1;
+module_param(hr_cpu, int, 0444);
+MODULE_PARM_DESC(hr_cpu, "CPU the hrtimer is pinned to, -1 for the loading CPU");
+
+static bool hr_soft;
+module_param(hr_soft, bool, 0444);
+MODULE_PARM_DESC(hr_soft, "expire in softirq instead of hard interrupt context");
+
+static unsigned int hr_slack_us;
+module_param(hr_slack_us, uint, 0444);
+MODULE_PARM_DESC(hr_slack_us, "how late each expiry may be, so it can share another timer's interrupt");
+
+#define HR_BUCKETS 32		/* bucket b holds lateness in [2^(b-1), 2^b) ns */
+
+static struct hrtimer hr_timer;
+static ktime_t hr_period;
+
+static struct {
+	u64 count;
+	u64 overruns;
+	u64 coalesced;
+	u64 sum_ns;
+	u64 max_ns;
+	u64 bucket[HR_BUCKETS];
+} hr_hist;
+
+static enum hrtimer_restart hr_expired(struct hrtimer *t)
+{
+	ktime_t now = hrtimer_cb_get_time(t);
+	s64 late = ktime_to_ns(ktime_sub(now, hrtimer_get_softexpires(t)));
+	int b = late > 0 ? min(fls64(late), HR_BUCKETS - 1) : 0;
+
+	if (late < 0)
+		late = 0;
+	/* Ran before its own hard expiry, on another timer's interrupt */
+	if (ktime_before(now, hrtimer_get_expires(t)))
+		hr_hist.coalesced++;
+	hr_hist.count++;
+	hr_hist.sum_ns += late;
+	if (late > hr_hist.max_ns)
+		hr_hist.max_ns = late;
+	hr_hist.bucket[b]++;
+
+	hr_hist.overruns += hrtimer_forward_now(t, hr_period) - 1;
+	return HRTIMER_RESTART;
+}
+
+static enum hrtimer_mode hr_mode(void)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,4,0)
+	if (!hr_soft)
+		return HRTIMER_MODE_ABS_PINNED_HARD;
+#endif
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,16,0)
+	if (hr_soft)
+		return HRTIMER_MODE_ABS_PINNED_SOFT;
+#endif
+	return HRTIMER_MODE_ABS_PINNED;
+}
+
+/* Runs on the target CPU so the pinned timer is queued there */
+static void hr_start(void *unused)
+{
+	/* hrtimer_forward_now() keeps the slack range for later periods */
+	hrtimer_start_range_ns(&hr_timer, ktime_add(ktime_get(), hr_period),
+			       (u64)hr_slack_us * NSEC_PER_USEC, hr_mode());
+}
+
+static int latency_show(struct seq_file *m, void *v)
+{
+	u64 count = READ_ONCE(hr_hist.count);
+	int b;
+
+	seq_printf(m, "period_ns %lld slack_us %u cpu %d %s\n", ktime_to_ns(hr_period),
+		   hr_slack_us, hr_cpu, hr_soft ? "soft" : "hard");
+	seq_printf(m, "expiries %llu overruns %llu coalesced %llu mean_ns %llu max_ns %llu\n",
+		   count, READ_ONCE(hr_hist.overruns), READ_ONCE(hr_hist.coalesced),
+		   count ? div64_u64(READ_ONCE(hr_hist.sum_ns), count) : 0,
+		   READ_ONCE(hr_hist.max_ns));
+	for (b = 0; b < HR_BUCKETS; b++)
+		if (hr_hist.bucket[b])
+			seq_printf(m, "<%llu ns: %llu\n", 1ULL << b,
+				   READ_ONCE(hr_hist.bucket[b]));
+	return 0;
+}
+
+static int latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, latency_show, NULL);
+}
+
+static ssize_t latency_write(struct file *file, const char __user *buf,
+			     size_t count, loff_t *ppos)
+{
+	/* Races with a running callback only cost a sample or two */
+	memset(&hr_hist, 0, sizeof(hr_hist));
+	return count;
+}
+
+static const struct file_operations latency_fops = {
+	.owner		= THIS_MODULE,
+	.open		= latency_open,
+	.read		= seq_read,
+	.write		= latency_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+static int hr_init(void)
+{
+	int ret;
+
+	if (hr_cpu < 0)
+		hr_cpu = raw_smp_processor_id();
+	if (hr_cpu >= nr_cpu_ids || !cpu_online(hr_cpu))
+		return -EINVAL;
+	/* Shorter periods can keep a CPU in the interrupt handler */
+	if (hr_period_us < 10)
+		return -EINVAL;
+
+	hr_period = us_to_ktime(hr_period_us);
+	hrtimer_init(&hr_timer, CLOCK_MONOTONIC, hr_mode());
+	hr_timer.function = hr_expired;
+
+	timer_dir = debugfs_create_dir("timer", NULL);
+	debugfs_create_file("latency", 0644, timer_dir, NULL, &latency_fops);
+
+	ret = smp_call_function_single(hr_cpu, hr_start, NULL, 1);
+	if (ret)
+		debugfs_remove_recursive(timer_dir);
+	return ret;
 }
 
 int timerTest_init(void)
 {	
 	printk("Timer Modules Init Called\n");
 
-	timer_setup(&exp_timer, do_something, 0); //third parameter is parameter passed to function
-
-	mod_timer(&exp_timer, jiffies + msecs_to_jiffies(1000)); //start the timer, if not activated before.
+	if (hr_period_us)
+		return hr_init();
 
-	
-	return 0;
+	return jiffies_init();
 }
 
 void timerTest_exit(void)
 {
-	del_timer(&exp_timer);
+	if (hr_period_us) {
+		hrtimer_cancel(&hr_timer);
+		debugfs_remove_recursive(timer_dir);
+	} else {
+		unsigned int i;
+
+		for (i = 0; i < instances; i++)
+			del_timer_sync(&exp_timers[i].timer);
+		debugfs_remove_recursive(timer_dir);
+		printk(KERN_INFO "timer: %lu expiries, %lu wakeups avoided\n",
+		       wk.expiries, wk.coalesced + wk.skipped);
+		kfree(exp_timers);
+	}
 	printk("Timer module Exit called\n");
 }
 
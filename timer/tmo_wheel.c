@@ -0,0 +1,325 @@
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/percpu.h>
+#include <linux/spinlock.h>
+#include <linux/timer.h>
+#include <linux/jiffies.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/wait.h>
+#include <linux/mutex.h>
+
+#include "tmo_wheel.h"
+
+MODULE_LICENSE("Dual BSD/GPL");
+
+/*
+ * Timeout service for drivers with many short-lived per-request
+ * timeouts, most of which are cancelled before they fire.
+ *
+ * Each CPU has a hierarchical timing wheel: TMO_LVL_DEPTH levels of 64
+ * slots, level l covering deltas below 64^(l+1) jiffies. Arming hashes
+ * the timeout into a slot and cancelling unlinks it, both O(1) under
+ * the local wheel's lock. Each wheel owns a single pinned timer_list,
+ * programmed for the next non-empty level 0 slot or the next cascade
+ * boundary, whichever comes first, so an idle stretch of the wheel
+ * costs no ticks. A tick cascades the higher level slots that come due
+ * into lower levels, as the classic kernel wheel did, and runs every
+ * timeout of the level 0 slots it passed in one batch.
+ *
+ * Writing N to debugfs tmo_wheel/selftest arms N timeouts on the local
+ * wheel, cancels every other one and waits for the rest to fire.
+ */
+
+#define TMO_LVL_BITS	6
+#define TMO_LVL_SIZE	(1 << TMO_LVL_BITS)
+#define TMO_LVL_MASK	(TMO_LVL_SIZE - 1)
+#define TMO_LVL_DEPTH	4
+#define TMO_MAX_DELTA	((1UL << (TMO_LVL_BITS * TMO_LVL_DEPTH)) - 1)
+
+struct tmo_wheel {
+	spinlock_t lock;
+	unsigned long clk;		/* next jiffy to process */
+	unsigned int count;		/* queued, including due ones */
+	bool ticking;
+	int cpu;
+	struct timer_list tick;
+	struct hlist_head due;		/* expired, callback not yet run */
+	struct hlist_head vec[TMO_LVL_DEPTH][TMO_LVL_SIZE];
+	unsigned long armed, cancelled, expired, ticks;
+};
+
+static DEFINE_PER_CPU(struct tmo_wheel, tmo_wheels);
+static struct dentry *tmo_dir;
+
+static void __tmo_enqueue(struct tmo_wheel *w, struct tmo *t)
+{
+	unsigned long expires = t->expires;
+	unsigned long delta = expires - w->clk;
+	int lvl = 0;
+
+	if ((long)delta < 0) {
+		/* Already due, goes in the slot processed next */
+		expires = w->clk;
+	} else {
+		if (delta > TMO_MAX_DELTA) {
+			/* Re-placed with the real expiry when it cascades */
+			expires = w->clk + TMO_MAX_DELTA;
+			delta = TMO_MAX_DELTA;
+		}
+		while (lvl < TMO_LVL_DEPTH - 1 &&
+		       delta >= 1UL << (TMO_LVL_BITS * (lvl + 1)))
+			lvl++;
+	}
+	hlist_add_head(&t->node,
+		       &w->vec[lvl][(expires >> (TMO_LVL_BITS * lvl)) & TMO_LVL_MASK]);
+}
+
+/* Move the slot of @lvl that is due at w->clk down; returns its index */
+static int tmo_cascade(struct tmo_wheel *w, int lvl)
+{
+	int idx = (w->clk >> (TMO_LVL_BITS * lvl)) & TMO_LVL_MASK;
+	struct hlist_node *n;
+	struct tmo *t;
+	HLIST_HEAD(list);
+
+	hlist_move_list(&w->vec[lvl][idx], &list);
+	hlist_for_each_entry_safe(t, n, &list, node)
+		__tmo_enqueue(w, t);
+	return idx;
+}
+
+/*
+ * First jiffy from w->clk on that has work: a non-empty level 0 slot,
+ * or the next multiple of TMO_LVL_SIZE, where higher levels cascade.
+ */
+static unsigned long tmo_next(struct tmo_wheel *w)
+{
+	unsigned long boundary = ALIGN(w->clk, TMO_LVL_SIZE);
+	unsigned long j;
+
+	for (j = w->clk; j != boundary; j++)
+		if (!hlist_empty(&w->vec[0][j & TMO_LVL_MASK]))
+			return j;
+	return boundary;
+}
+
+static void tmo_tick(struct timer_list *tl)
+{
+	struct tmo_wheel *w = from_timer(w, tl, tick);
+	struct hlist_node *n;
+	struct tmo *t;
+	int idx, lvl;
+
+	spin_lock_irq(&w->lock);
+	w->ticks++;
+	while (time_after_eq(jiffies, w->clk)) {
+		idx = w->clk & TMO_LVL_MASK;
+		for (lvl = 1; !idx && lvl < TMO_LVL_DEPTH; lvl++)
+			idx = tmo_cascade(w, lvl);
+		idx = w->clk & TMO_LVL_MASK;
+		hlist_for_each_entry_safe(t, n, &w->vec[0][idx], node) {
+			hlist_del(&t->node);
+			hlist_add_head(&t->node, &w->due);
+		}
+		w->clk++;
+	}
+
+	/*
+	 * Due timeouts stay owned by the wheel, and cancellable, until
+	 * their callback is about to run; the lock is dropped around each
+	 * callback as the core timer code does.
+	 */
+	while (!hlist_empty(&w->due)) {
+		t = hlist_entry(w->due.first, struct tmo, node);
+		hlist_del_init(&t->node);
+		WRITE_ONCE(t->wheel, NULL);
+		w->count--;
+		w->expired++;
+		spin_unlock_irq(&w->lock);
+		t->fn(t);
+		spin_lock_irq(&w->lock);
+	}
+
+	if (w->count)
+		mod_timer(&w->tick, tmo_next(w));
+	else
+		w->ticking = false;
+	spin_unlock_irq(&w->lock);
+}
+
+/* Arm @t to fire @timeout jiffies from now on the local CPU's wheel */
+void tmo_arm(struct tmo *t, unsigned long timeout)
+{
+	struct tmo_wheel *w;
+	unsigned long flags;
+
+	tmo_cancel(t);
+
+	local_irq_save(flags);
+	w = this_cpu_ptr(&tmo_wheels);
+	spin_lock(&w->lock);
+	if (!w->ticking)
+		w->clk = jiffies;	/* idle wheel, nothing to catch up */
+	t->expires = jiffies + timeout;
+	__tmo_enqueue(w, t);
+	WRITE_ONCE(t->wheel, w);
+	w->count++;
+	w->armed++;
+	if (!w->ticking) {
+		w->ticking = true;
+		w->tick.expires = tmo_next(w);
+		add_timer_on(&w->tick, w->cpu);
+	} else {
+		/* Only ever pulls the tick in; it is pinned to this CPU */
+		timer_reduce(&w->tick, tmo_next(w));
+	}
+	spin_unlock_irqrestore(&w->lock, flags);
+}
+EXPORT_SYMBOL_GPL(tmo_arm);
+
+/*
+ * Returns true if @t was pending and will not fire. False means it was
+ * idle or its callback has already started.
+ */
+bool tmo_cancel(struct tmo *t)
+{
+	struct tmo_wheel *w;
+	unsigned long flags;
+
+	for (;;) {
+		w = READ_ONCE(t->wheel);
+		if (!w)
+			return false;
+		spin_lock_irqsave(&w->lock, flags);
+		if (t->wheel == w)
+			break;
+		/* Fired or moved to another wheel meanwhile */
+		spin_unlock_irqrestore(&w->lock, flags);
+	}
+	hlist_del_init(&t->node);
+	WRITE_ONCE(t->wheel, NULL);
+	w->count--;
+	w->cancelled++;
+	spin_unlock_irqrestore(&w->lock, flags);
+	return true;
+}
+EXPORT_SYMBOL_GPL(tmo_cancel);
+
+static int stats_show(struct seq_file *m, void *v)
+{
+	int cpu;
+
+	seq_puts(m, "cpu queued armed cancelled expired ticks\n");
+	for_each_possible_cpu(cpu) {
+		struct tmo_wheel *w = per_cpu_ptr(&tmo_wheels, cpu);
+
+		seq_printf(m, "%d %u %lu %lu %lu %lu\n", cpu, READ_ONCE(w->count),
+			   READ_ONCE(w->armed), READ_ONCE(w->cancelled),
+			   READ_ONCE(w->expired), READ_ONCE(w->ticks));
+	}
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(stats);
+
+/* Self-test: spread timeouts over the first two levels and a cascade */
+#define TMO_TEST_SPREAD	(3 * TMO_LVL_SIZE)
+
+static DEFINE_MUTEX(test_lock);
+static DECLARE_WAIT_QUEUE_HEAD(test_wq);
+static atomic_t test_fired;
+static unsigned long test_late_max;
+
+static void tmo_test_fn(struct tmo *t)
+{
+	unsigned long late = jiffies - t->expires;
+
+	/* Racy if the test migrated across wheels; it is only reported */
+	if (late > READ_ONCE(test_late_max))
+		WRITE_ONCE(test_late_max, late);
+	atomic_inc(&test_fired);
+	wake_up(&test_wq);
+}
+
+static ssize_t selftest_write(struct file *file, const char __user *buf,
+			      size_t count, loff_t *ppos)
+{
+	unsigned int n, i, cancelled = 0, expect;
+	struct tmo *t;
+	long left;
+	int ret;
+
+	ret = kstrtouint_from_user(buf, count, 0, &n);
+	if (ret)
+		return ret;
+	if (!n)
+		return -EINVAL;
+	t = kvcalloc(n, sizeof(*t), GFP_KERNEL);
+	if (!t)
+		return -ENOMEM;
+	mutex_lock(&test_lock);
+	atomic_set(&test_fired, 0);
+	test_late_max = 0;
+
+	for (i = 0; i < n; i++) {
+		tmo_init(&t[i], tmo_test_fn);
+		tmo_arm(&t[i], i % TMO_TEST_SPREAD);
+	}
+	for (i = 1; i < n; i += 2)
+		cancelled += tmo_cancel(&t[i]);
+	expect = n - cancelled;
+
+	left = wait_event_timeout(test_wq, atomic_read(&test_fired) == expect,
+				  TMO_TEST_SPREAD + HZ);
+	/* Stragglers must be gone, or running, before the array is freed */
+	for (i = 0; i < n; i++)
+		cancelled += tmo_cancel(&t[i]);
+	wait_event(test_wq, atomic_read(&test_fired) == n - cancelled);
+
+	pr_info("tmo_wheel: selftest %u armed %u cancelled %u fired, %lu jiffies max late%s\n",
+		n, cancelled, n - cancelled, test_late_max,
+		left ? "" : ", TIMED OUT");
+	mutex_unlock(&test_lock);
+	kvfree(t);
+	return left ? count : -ETIME;
+}
+
+static const struct file_operations selftest_fops = {
+	.owner	= THIS_MODULE,
+	.write	= selftest_write,
+	.llseek	= noop_llseek,
+};
+
+static int tmo_wheel_init(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct tmo_wheel *w = per_cpu_ptr(&tmo_wheels, cpu);
+
+		spin_lock_init(&w->lock);
+		w->cpu = cpu;
+		w->clk = jiffies;
+		timer_setup(&w->tick, tmo_tick, TIMER_PINNED);
+	}
+
+	tmo_dir = debugfs_create_dir("tmo_wheel", NULL);
+	debugfs_create_file("stats", 0444, tmo_dir, NULL, &stats_fops);
+	debugfs_create_file("selftest", 0200, tmo_dir, NULL, &selftest_fops);
+	return 0;
+}
+
+static void tmo_wheel_exit(void)
+{
+	int cpu;
+
+	debugfs_remove_recursive(tmo_dir);
+	/* Users hold a module reference, so every wheel is empty by now */
+	for_each_possible_cpu(cpu)
+		del_timer_sync(&per_cpu_ptr(&tmo_wheels, cpu)->tick);
+}
+
+module_init(tmo_wheel_init);
+module_exit(tmo_wheel_exit);
@@ -0,0 +1,41 @@
+/*
+ * tmo_wheel.h -- per-request timeouts on a per-CPU hierarchical wheel
+ */
+
+#ifndef _TMO_WHEEL_H
+#define _TMO_WHEEL_H
+
+#include <linux/list.h>
+#include <linux/compiler.h>
+
+struct tmo_wheel;
+
+/*
+ * Embed one of these in each request. fn is called from the wheel's
+ * tick (softirq context, no locks held) once the timeout passes; it may
+ * re-arm the timeout. A given tmo must not be armed or cancelled from
+ * two contexts at once.
+ */
+struct tmo {
+	struct hlist_node node;
+	unsigned long expires;		/* jiffies */
+	struct tmo_wheel *wheel;	/* wheel it is queued on, or NULL */
+	void (*fn)(struct tmo *t);
+};
+
+static inline void tmo_init(struct tmo *t, void (*fn)(struct tmo *t))
+{
+	INIT_HLIST_NODE(&t->node);
+	t->wheel = NULL;
+	t->fn = fn;
+}
+
+static inline bool tmo_pending(const struct tmo *t)
+{
+	return READ_ONCE(t->wheel) != NULL;
+}
+
+void tmo_arm(struct tmo *t, unsigned long timeout);
+bool tmo_cancel(struct tmo *t);
+
+#endif /* _TMO_WHEEL_H */
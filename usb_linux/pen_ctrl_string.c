@@ -5,6 +5,8 @@
 #include <linux/usb.h>
 #include <linux/uaccess.h>
 
+#include "../evtrace/evtrace.h"
+
 #define SIZE 50
 static void string_desc(struct usb_device *dev, int index)
 {
@@ -22,7 +24,7 @@ static void string_desc(struct usb_device *dev, int index)
     err = utf16s_to_utf8s((wchar_t *) &tbuf[2], (err - 2) / 2,
 			UTF16_LITTLE_ENDIAN, buf, SIZE/2);
     buf[err] = 0;
-    pr_info("string index %d is %s", index, buf);
+    evtrace("string index %d is %s", index, buf);
 
     kfree(tbuf);
 }
@@ -34,7 +36,7 @@ static int pen_probe(struct usb_interface *interface,
 
     device = interface_to_usbdev(interface);
 
-    pr_info("Pen Probe control msg Function");
+    evtrace("Pen Probe control msg Function");
 
     string_desc(device, 1);
     string_desc(device, 2);
@@ -45,7 +47,7 @@ static int pen_probe(struct usb_interface *interface,
 
 static void pen_disconnect(struct usb_interface *interface)
 {
-	pr_info("Disconnect");
+	evtrace("Disconnect");
 }
 
 /* Table of devices that work with this driver */
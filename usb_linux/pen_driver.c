@@ -3,6 +3,8 @@
 #include <linux/usb.h>
 #include <linux/uaccess.h>
 
+#include "../evtrace/evtrace.h"
+
 #define MIN(a,b) (((a) <= (b)) ? (a) : (b))
 #define BULK_EP_OUT 0x01
 #define BULK_EP_IN 0x82
@@ -91,7 +93,7 @@ static int pen_probe(struct usb_interface *interface, const struct usb_device_id
     }
     else
     {
-        printk(KERN_INFO "Minor obtained: %d\n", interface->minor);
+        evtrace("Minor obtained: %d\n", interface->minor);
     }
 
     return retval;
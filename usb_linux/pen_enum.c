@@ -2,16 +2,18 @@
 #include <linux/kernel.h>
 #include <linux/usb.h>
 
+#include "../evtrace/evtrace.h"
+
 static int pen_probe(struct usb_interface *interface, const struct usb_device_id *id)
 {
-    printk(KERN_INFO "Pen drive (%04X:%04X) plugged\n", id->idVendor,
+    evtrace("Pen drive (%04X:%04X) plugged\n", id->idVendor,
                                 id->idProduct);
     return 0;
 }
 
 static void pen_disconnect(struct usb_interface *interface)
 {
-    printk(KERN_INFO "Pen drive removed\n");
+    evtrace("Pen drive removed\n");
 }
 
 static struct usb_device_id pen_table[] =
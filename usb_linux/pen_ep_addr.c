@@ -2,6 +2,8 @@
 #include <linux/kernel.h>
 #include <linux/usb.h>
 
+#include "../evtrace/evtrace.h"
+
 static int pen_probe(struct usb_interface *interface, const struct usb_device_id *id)
 {
 	struct usb_device *udevice;
@@ -24,7 +26,7 @@ static int pen_probe(struct usb_interface *interface, const struct usb_device_id
 	uconfig = udevice->actconfig;
 	u_c_desc  = uconfig->desc;
 
-	printk(KERN_INFO "Pen drive (%04X:%04X) plugged\n", id->idVendor,
+	evtrace("Pen drive (%04X:%04X) plugged\n", id->idVendor,
 	       id->idProduct);
 
 	for(i=0; i<u_c_desc.bNumInterfaces; i++) {
@@ -37,7 +39,7 @@ static int pen_probe(struct usb_interface *interface, const struct usb_device_id
 			for(k=0; k<u_i_desc.bNumEndpoints; k++) {
 				uendpoint  = &ualtsetting->endpoint[k];
 				u_e_desc = uendpoint->desc;
-				printk("Endpoint address = %x\n", u_e_desc.bEndpointAddress);
+				evtrace("Endpoint address = %x\n", u_e_desc.bEndpointAddress);
 			}
 		}
 	}
@@ -47,7 +49,7 @@ static int pen_probe(struct usb_interface *interface, const struct usb_device_id
 
 static void pen_disconnect(struct usb_interface *interface)
 {
-    printk(KERN_INFO "Pen drive removed\n");
+    evtrace("Pen drive removed\n");
 }
 
 static struct usb_device_id pen_table[] =
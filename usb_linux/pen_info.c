@@ -2,6 +2,8 @@
 #include <linux/kernel.h>
 #include <linux/usb.h>
 
+#include "../evtrace/evtrace.h"
+
 static struct usb_device *device;
 
 static int pen_probe(struct usb_interface *interface, const struct usb_device_id *id)
@@ -11,23 +13,23 @@ static int pen_probe(struct usb_interface *interface, const struct usb_device_id
     int i;
 
     iface_desc = interface->cur_altsetting;
-    printk(KERN_INFO "Pen i/f %d now probed: (%04X:%04X)\n",
+    evtrace("Pen i/f %d now probed: (%04X:%04X)\n",
             iface_desc->desc.bInterfaceNumber,
             id->idVendor, id->idProduct);
-    printk(KERN_INFO "ID->bNumEndpoints: %02X\n",
+    evtrace("ID->bNumEndpoints: %02X\n",
             iface_desc->desc.bNumEndpoints);
-    printk(KERN_INFO "ID->bInterfaceClass: %02X\n",
+    evtrace("ID->bInterfaceClass: %02X\n",
             iface_desc->desc.bInterfaceClass);
 
     for (i = 0; i < iface_desc->desc.bNumEndpoints; i++)
     {
         endpoint = &iface_desc->endpoint[i].desc;
 
-        printk(KERN_INFO "ED[%d]->bEndpointAddress: 0x%02X\n",
+        evtrace("ED[%d]->bEndpointAddress: 0x%02X\n",
                 i, endpoint->bEndpointAddress);
-        printk(KERN_INFO "ED[%d]->bmAttributes: 0x%02X\n",
+        evtrace("ED[%d]->bmAttributes: 0x%02X\n",
                 i, endpoint->bmAttributes);
-        printk(KERN_INFO "ED[%d]->wMaxPacketSize: 0x%04X (%d)\n",
+        evtrace("ED[%d]->wMaxPacketSize: 0x%04X (%d)\n",
                 i, endpoint->wMaxPacketSize,
                 endpoint->wMaxPacketSize);
     }
@@ -38,7 +40,7 @@ static int pen_probe(struct usb_interface *interface, const struct usb_device_id
 
 static void pen_disconnect(struct usb_interface *interface)
 {
-    printk(KERN_INFO "Pen i/f %d now disconnected\n",
+    evtrace("Pen i/f %d now disconnected\n",
             interface->cur_altsetting->desc.bInterfaceNumber);
 }
 
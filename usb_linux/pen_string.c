@@ -3,6 +3,8 @@
 #include <linux/usb.h>
 #include <linux/uaccess.h>
 
+#include "../evtrace/evtrace.h"
+
 
 static int pen_probe(struct usb_interface *interface,
 		     const struct usb_device_id *id)
@@ -12,22 +14,22 @@ static int pen_probe(struct usb_interface *interface,
 
     device = interface_to_usbdev(interface);
 
-    pr_info("Pen Probe Function");
+    evtrace("Pen Probe Function");
     usb_string(device, 1, buf, 15);
-    pr_info("string 1 is %s", buf);
+    evtrace("string 1 is %s", buf);
 
     usb_string(device, 2, buf, 15);
-    pr_info("string 2 is %s", buf);
+    evtrace("string 2 is %s", buf);
 
     usb_string(device, 3, buf, 15);
-    pr_info("string 3 is %s", buf);
+    evtrace("string 3 is %s", buf);
 
     return 0;
 }
 
 static void pen_disconnect(struct usb_interface *interface)
 {
-	pr_info("Disconnect");
+	evtrace("Disconnect");
 }
 
 /* Table of devices that work with this driver */
@@ -5,6 +5,8 @@
 #include <linux/usb.h>
 #include <linux/uaccess.h>
 
+#include "../evtrace/evtrace.h"
+
 struct usb_ctrlrequest ctrl_req;
 struct completion config_done;
 
@@ -53,7 +55,7 @@ static void string_desc(struct usb_device *dev,
 			  UTF16_LITTLE_ENDIAN, buf, SIZE/2);
     buf[err] = 0;
 
-    pr_info("string index %d is %s", index, buf);
+    evtrace("string index %d is %s", index, buf);
 
     usb_free_urb(ctrl_urb);
 
@@ -65,7 +67,7 @@ static int pen_probe(struct usb_interface *interface,
 {
     struct usb_device *device;
 
-    pr_info("Pen Probe control urb Function");
+    evtrace("Pen Probe control urb Function");
 
     device = interface_to_usbdev(interface);
 
@@ -78,7 +80,7 @@ static int pen_probe(struct usb_interface *interface,
 
 static void pen_disconnect(struct usb_interface *interface)
 {
-	pr_info("Disconnect");
+	evtrace("Disconnect");
 }
 
 /* Table of devices that work with this driver */
@@ -3,76 +3,581 @@
 // when you read the device /dev/myled, it waits for the wait queue.
 // open the another terminal, write to the /proc device... echo "hello" > /proc/wait.
 // when we write to proc device, it will send the wait queue, which will wake up /dev/myled read function. 
+// Every open of /dev/led gets its own message queue, so any number of readers
+// can wait at the same time and each of them receives every message written.
+// With event_log=1 messages go to one shared, sequence-numbered ring instead,
+// and every open file reads it through its own cursor without taking a lock.
 
 
 #include <linux/module.h>
 #include <linux/kernel.h>
 #include <linux/fs.h> // required for various structures related to files liked fops.
 #include <linux/uaccess.h> // required for copy_from and copy_to user functions
-#include <linux/semaphore.h>
 #include <linux/cdev.h>
 #include <linux/proc_fs.h>
 #include <linux/wait.h> // Required for the wait queues
 #include <linux/sched.h> // Required for task states (TASK_INTERRUPTIBLE etc )
+#include <linux/slab.h>
+#include <linux/kref.h>
+#include <linux/list.h>
+#include <linux/rculist.h>
+#include <linux/spinlock.h>
+#include <linux/log2.h>
+#include <linux/poll.h>
+#include <linux/seqlock.h>
+#include <linux/atomic.h>
+#include <linux/vmalloc.h>
+#include <linux/uio.h>
+#include <linux/splice.h>
+#include <linux/version.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+
+#include "read_wait.h"
+#include "../evtrace/evtrace.h"
+
+// splice()/sendfile() ride on read_iter/write_iter, no user bounce buffer
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,5,0)
+#define wait_splice_read copy_splice_read
+#else
+#define wait_splice_read generic_file_splice_read
+#endif
+
+// class_create() lost its owner argument in 6.4
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,4,0)
+#define wait_class_create(name) class_create(name)
+#else
+#define wait_class_create(name) class_create(THIS_MODULE, name)
+#endif
 
 
 static int Major;
 struct proc_dir_entry *Our_Proc_File;
-wait_queue_head_t queue;
-char flag = 'n';
 static struct class *led_class;
 
+/*
+ * Number of messages each open file can hold before new ones are
+ * dropped for it. Rounded up to a power of two.
+ */
+static unsigned int queue_depth = 64;
+module_param(queue_depth, uint, 0444);
+
+#define MSG_MAX PAGE_SIZE
+
+/*
+ * Event-log mode: every event is kept in a ring of log_size slots
+ * (rounded up to a power of two) and each reader walks it with its own
+ * cursor. Events longer than LOG_MSG_MAX are truncated.
+ */
+static bool event_log;
+module_param(event_log, bool, 0444);
+
+static unsigned int log_size = 256;
+module_param(log_size, uint, 0444);
+
+#define LOG_MSG_MAX 256
 
-struct deviceTest {
-    char array[100];
-    struct semaphore sem;
-}char_arr;
+struct wait_log_slot {
+    seqcount_t seq;
+    u64 id;                // sequence number of the event stored here
+    size_t len;
+    char data[LOG_MSG_MAX];
+};
+
+static struct {
+    struct wait_log_slot *slots;
+    unsigned int mask;
+    atomic64_t head;       // id of the last published event, 0 if none
+    spinlock_t lock;       // serializes writers only
+} wlog;
+
+/*
+ * One message, shared by every reader queue it was posted to.
+ */
+struct wait_msg {
+    struct kref ref;
+    size_t len;
+    char data[];
+};
+
+/*
+ * Per-open state, hung off filp->private_data. The queue has its own
+ * lock, so readers only ever contend with the writers feeding them.
+ */
+struct wait_reader {
+    struct list_head node;
+    spinlock_t lock;
+    wait_queue_head_t wq;
+    unsigned int head, tail, mask;
+    size_t bytes;          // bytes queued, for the low watermark
+    unsigned long dropped;
+    atomic64_t log_next;   // event-log mode: next id to read
+    unsigned long overruns;
+    struct wait_lowat lowat;
+    struct hrtimer timer;  // coalescing timeout
+    bool expired;
+    struct wait_msg *ring[];
+};
+
+/* Open files, walked under RCU by writers */
+static LIST_HEAD(readers);
+static DEFINE_SPINLOCK(readers_lock);
 
 struct cdev *kernel_cdev;
 
 
-int open(struct inode *inode, struct file *filp)
+static void wait_msg_free(struct kref *ref)
 {
-   
-    printk(KERN_INFO "Inside open \n");
-    if(down_interruptible(&char_arr.sem)) {
-        printk(KERN_INFO " could not hold semaphore");
-        return -1;
+    kfree(container_of(ref, struct wait_msg, ref));
+}
+
+// Dequeue the oldest message, but only if it is at most @room bytes long
+static struct wait_msg *wait_msg_get(struct wait_reader *r, size_t room)
+{
+    struct wait_msg *msg = NULL;
+
+    spin_lock(&r->lock);
+    if (r->head != r->tail && r->ring[r->tail & r->mask]->len <= room) {
+        msg = r->ring[r->tail++ & r->mask];
+        r->bytes -= msg->len;
+    }
+    spin_unlock(&r->lock);
+    return msg;
+}
+
+static bool wait_reader_empty(struct wait_reader *r)
+{
+    if (event_log)
+        return atomic64_read(&r->log_next) > atomic64_read_acquire(&wlog.head);
+    return READ_ONCE(r->head) == READ_ONCE(r->tail);
+}
+
+/*
+ * Whether a blocked reader should be woken: something is pending and
+ * either a low watermark is met, the coalescing timeout fired, or no
+ * watermark is set at all.
+ */
+static bool wait_reader_ready(struct wait_reader *r)
+{
+    u32 ev = READ_ONCE(r->lowat.events), by = READ_ONCE(r->lowat.bytes);
+    size_t bytes = 0;
+    u64 events;
+
+    if (event_log) {
+        s64 d = atomic64_read_acquire(&wlog.head) - atomic64_read(&r->log_next) + 1;
+        events = d > 0 ? d : 0;
+    } else {
+        events = READ_ONCE(r->head) - READ_ONCE(r->tail);
+        bytes = READ_ONCE(r->bytes);
     }
+
+    if (!events)
+        return false;
+    if ((!ev && !by) || READ_ONCE(r->expired))
+        return true;
+    // A full queue only drops from here on, whatever the byte count is
+    if (!event_log && events > READ_ONCE(r->mask))
+        return true;
+    return (ev && events >= ev) || (by && bytes >= by);
+}
+
+static enum hrtimer_restart wait_reader_timeout(struct hrtimer *t)
+{
+    struct wait_reader *r = container_of(t, struct wait_reader, timer);
+
+    WRITE_ONCE(r->expired, true);
+    wake_up_interruptible_poll(&r->wq, EPOLLIN | EPOLLRDNORM);
+    return HRTIMER_NORESTART;
+}
+
+/*
+ * Called after new data reached @r. Wake it if it is ready, otherwise
+ * make sure the coalescing timer runs so the data is not held forever.
+ */
+static void wait_reader_kick(struct wait_reader *r)
+{
+    u32 timeout_us = READ_ONCE(r->lowat.timeout_us);
+
+    if (wait_reader_ready(r))
+        // wakes pollers plus a single exclusive reader, not the whole pool
+        wake_up_interruptible_poll(&r->wq, EPOLLIN | EPOLLRDNORM);
+    else if (timeout_us && !hrtimer_active(&r->timer))
+        hrtimer_start(&r->timer, us_to_ktime(timeout_us), HRTIMER_MODE_REL);
+}
+
+/*
+ * Queue a message on every open file and wake whoever sleeps there.
+ */
+static void wait_msg_post(struct wait_msg *msg)
+{
+    struct wait_reader *r;
+
+    rcu_read_lock();
+    list_for_each_entry_rcu(r, &readers, node) {
+        spin_lock(&r->lock);
+        if (r->head - r->tail > r->mask) {
+            r->dropped++;
+            spin_unlock(&r->lock);
+            continue;
+        }
+        kref_get(&msg->ref);
+        r->ring[r->head++ & r->mask] = msg;
+        r->bytes += msg->len;
+        spin_unlock(&r->lock);
+        wait_reader_kick(r);
+    }
+    rcu_read_unlock();
+    kref_put(&msg->ref, wait_msg_free);
+}
+
+static int wait_log_init(void)
+{
+    unsigned int i, n = roundup_pow_of_two(max(log_size, 1U));
+
+    wlog.slots = vzalloc(array_size(n, sizeof(*wlog.slots)));
+    if (!wlog.slots)
+        return -ENOMEM;
+    for (i = 0; i < n; i++)
+        seqcount_init(&wlog.slots[i].seq);
+    wlog.mask = n - 1;
+    atomic64_set(&wlog.head, 0);
+    spin_lock_init(&wlog.lock);
+    return 0;
+}
+
+/*
+ * Append one event to the log. The slot being recycled is rewritten
+ * inside its seqcount write section, so a lockless reader racing with
+ * us either sees the old event whole, the new one whole, or retries.
+ */
+static void wait_log_post(const char *buf, size_t len)
+{
+    struct wait_log_slot *slot;
+    struct wait_reader *r;
+    u64 id;
+
+    len = min_t(size_t, len, LOG_MSG_MAX);
+    spin_lock(&wlog.lock);
+    id = atomic64_read(&wlog.head) + 1;
+    slot = &wlog.slots[id & wlog.mask];
+    write_seqcount_begin(&slot->seq);
+    slot->id = id;
+    slot->len = len;
+    memcpy(slot->data, buf, len);
+    write_seqcount_end(&slot->seq);
+    atomic64_set_release(&wlog.head, id);
+    spin_unlock(&wlog.lock);
+
+    rcu_read_lock();
+    list_for_each_entry_rcu(r, &readers, node)
+        wait_reader_kick(r);
+    rcu_read_unlock();
+}
+
+/*
+ * Copy out the event at the reader's cursor without taking any lock.
+ * Returns -EOVERFLOW once, after moving the cursor to the oldest event
+ * still in the ring, when the writer lapped this reader. Only the first
+ * record of a read may be truncated or report an overrun; later ones
+ * that don't fit are left for the next read.
+ */
+static ssize_t wait_log_read(struct wait_reader *r, struct iov_iter *to, bool first)
+{
+    char buf[LOG_MSG_MAX];
+    struct wait_log_slot *slot;
+    unsigned int seq;
+    u64 next, head, id;
+    size_t len;
+
+    for (;;) {
+        next = atomic64_read(&r->log_next);
+        head = atomic64_read_acquire(&wlog.head);
+        if (next > head)
+            return -EAGAIN;
+
+        if (head - next > wlog.mask) {
+            if (!first)
+                return -EAGAIN;
+            if (atomic64_cmpxchg(&r->log_next, next, head - wlog.mask) != next)
+                continue;
+            r->overruns += head - wlog.mask - next;
+            return -EOVERFLOW;
+        }
+
+        slot = &wlog.slots[next & wlog.mask];
+        do {
+            seq = read_seqcount_begin(&slot->seq);
+            id = slot->id;
+            len = min(slot->len, (size_t)LOG_MSG_MAX);
+            memcpy(buf, slot->data, len);
+        } while (read_seqcount_retry(&slot->seq, seq));
+
+        if (id != next)            // recycled under us, re-check the cursor
+            continue;
+        if (!first && len > iov_iter_count(to))
+            return -EAGAIN;
+        // Another thread sharing this file may have taken it already
+        if (atomic64_cmpxchg(&r->log_next, next, next + 1) != next)
+            continue;
+        break;
+    }
+
+    len = copy_to_iter(buf, min(len, iov_iter_count(to)), to);
+    return len ? len : -EFAULT;
+}
+
+static ssize_t wait_msg_read(struct wait_reader *r, struct iov_iter *to, bool first)
+{
+    struct wait_msg *msg;
+    size_t len;
+
+    msg = wait_msg_get(r, first ? SIZE_MAX : iov_iter_count(to));
+    if (!msg)
+        return -EAGAIN;
+    len = copy_to_iter(msg->data, min(msg->len, iov_iter_count(to)), to);
+    kref_put(&msg->ref, wait_msg_free);
+    return len ? len : -EFAULT;
+}
+
+static struct wait_msg *wait_msg_alloc(size_t count)
+{
+    struct wait_msg *msg;
+
+    msg = kmalloc(sizeof(*msg) + count, GFP_KERNEL);
+    if (!msg)
+        return NULL;
+    kref_init(&msg->ref);
+    msg->len = count;
+    return msg;
+}
+
+/*
+ * Hand a filled message to the readers, either by queueing it on every
+ * open file or by appending it to the event log.
+ */
+static ssize_t wait_post(struct wait_msg *msg)
+{
+    size_t len = msg->len;
+
+    if (event_log) {
+        wait_log_post(msg->data, len);
+        kfree(msg);
+    } else
+        wait_msg_post(msg);
+    return len;
+}
+
+static ssize_t wait_msg_post_user(const char __user *buff, size_t count)
+{
+    struct wait_msg *msg;
+
+    count = min_t(size_t, count, MSG_MAX);
+    if (!count)
+        return 0;
+    msg = wait_msg_alloc(count);
+    if (!msg)
+        return -ENOMEM;
+    if (copy_from_user(msg->data, buff, count)) {
+        kfree(msg);
+        return -EFAULT;
+    }
+    return wait_post(msg);
+}
+
+
+int open(struct inode *inode, struct file *filp)
+{
+    struct wait_reader *r;
+    unsigned int depth = roundup_pow_of_two(max(queue_depth, 1U));
+
+    evtrace("Inside open \n");
+    r = kzalloc(struct_size(r, ring, depth), GFP_KERNEL);
+    if (!r)
+        return -ENOMEM;
+    spin_lock_init(&r->lock);
+    init_waitqueue_head(&r->wq);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,13,0)
+    hrtimer_setup(&r->timer, wait_reader_timeout, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+#else
+    hrtimer_init(&r->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    r->timer.function = wait_reader_timeout;
+#endif
+    r->mask = depth - 1;
+    atomic64_set(&r->log_next, atomic64_read(&wlog.head) + 1);
+    filp->private_data = r;
+    filp->f_mode |= FMODE_NOWAIT;
+
+    spin_lock(&readers_lock);
+    list_add_tail_rcu(&r->node, &readers);
+    spin_unlock(&readers_lock);
     return 0;
 }
 
 
 int release(struct inode *inode, struct file *filp) {
-    printk (KERN_INFO "Inside close \n");
-    printk(KERN_INFO "Releasing semaphore");
-    up(&char_arr.sem);
+    struct wait_reader *r = filp->private_data;
+    struct wait_msg *msg;
+
+    evtrace("Inside close \n");
+    spin_lock(&readers_lock);
+    list_del_rcu(&r->node);
+    spin_unlock(&readers_lock);
+    synchronize_rcu();    // no writer can be posting to r past this point
+    hrtimer_cancel(&r->timer);
+
+    while ((msg = wait_msg_get(r, SIZE_MAX)))
+        kref_put(&msg->ref, wait_msg_free);
+    if (r->dropped)
+        evtrace("reader dropped %lu messages\n", r->dropped);
+    if (r->overruns)
+        evtrace("reader overran %lu events\n", r->overruns);
+    kfree(r);
     return 0;
 }
 
-ssize_t read(struct file *filp, char *buff, size_t count, loff_t *offp) {
-    unsigned long ret;
-    printk("Inside read \n");
-    wait_event_interruptible(queue, flag != 'n');
-    printk(KERN_INFO "Woken Up");
-//    ret = copy_to_user(buff, char_arr.array, count);
-    flag = 'n';
+/*
+ * Blocks for the first message only, then packs as many further whole
+ * messages as are already queued and fit, so readv() or a large read()
+ * drains many records in one call. A blocking reader first waits for
+ * its low watermark or coalescing timeout; a non-blocking one takes
+ * whatever is there.
+ */
+ssize_t read_iter(struct kiocb *iocb, struct iov_iter *to) {
+    struct file *filp = iocb->ki_filp;
+    struct wait_reader *r = filp->private_data;
+    bool nowait = (filp->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT);
+    ssize_t ret, done = 0;
+
+    evtrace("Inside read \n");
+    if (!nowait && wait_event_interruptible_exclusive(r->wq, wait_reader_ready(r)))
+        return -ERESTARTSYS;
+
+    while (iov_iter_count(to)) {
+        if (event_log)
+            ret = wait_log_read(r, to, !done);
+        else
+            ret = wait_msg_read(r, to, !done);
+        if (ret > 0) {
+            done += ret;
+            continue;
+        }
+        if (done)
+            break;
+        if (ret != -EAGAIN)
+            return ret;
+        if (nowait)
+            return -EAGAIN;
+        if (wait_event_interruptible_exclusive(r->wq, wait_reader_ready(r)))
+            return -ERESTARTSYS;
+        evtrace("Woken Up");
+    }
+
+    /*
+     * The timeout only covers what was pending when it fired. Re-arm
+     * for anything that slipped in since, and hand the wakeup on to
+     * the next exclusive waiter if there is still enough for it.
+     */
+    WRITE_ONCE(r->expired, false);
+    smp_mb();
+    if (!wait_reader_empty(r))
+        wait_reader_kick(r);
+    return done;
+}
+
+// A writev() is gathered into a single message
+ssize_t write_iter(struct kiocb *iocb, struct iov_iter *from) {
+    struct wait_msg *msg;
+    size_t count = min_t(size_t, iov_iter_count(from), MSG_MAX);
+
+    evtrace("Inside write \n");
+    if (!count)
+        return 0;
+    msg = wait_msg_alloc(count);
+    if (!msg)
+        return -ENOMEM;
+    if (!copy_from_iter_full(msg->data, count, from)) {
+        kfree(msg);
+        return -EFAULT;
+    }
+    return wait_post(msg);
+}
+
+static long wait_set_lowat(struct wait_reader *r, const struct wait_lowat __user *arg)
+{
+    unsigned int depth = event_log ? wlog.mask + 1 : r->mask + 1;
+    struct wait_lowat lw;
+
+    if (copy_from_user(&lw, arg, sizeof(lw)))
+        return -EFAULT;
+    /*
+     * A watermark the queue can never reach would only ever time out,
+     * or never wake the reader at all without a timeout.
+     */
+    if (lw.events > depth || lw.timeout_us > USEC_PER_SEC * 60)
+        return -EINVAL;
+    if (!event_log && (u64)lw.bytes > (u64)depth * MSG_MAX)
+        return -EINVAL;
+
+    spin_lock(&r->lock);
+    r->lowat = lw;
+    spin_unlock(&r->lock);
+    if (!wait_reader_empty(r))
+        wait_reader_kick(r);
     return 0;
 }
 
-ssize_t write(struct file *filp, const char *buff, size_t count, loff_t *offp) {   
-    unsigned long ret;
-    printk(KERN_INFO "Inside write \n");
-    ret =    copy_from_user(char_arr.array, buff, count);
-    return ret;
+long ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+    struct wait_reader *r = filp->private_data;
+
+    switch (cmd) {
+    case WAIT_IOC_SET_LOWAT:
+        return wait_set_lowat(r, (const struct wait_lowat __user *)arg);
+    case WAIT_IOC_GET_LOWAT: {
+        struct wait_lowat lw;
+
+        // SET replaces the whole struct under the lock, don't read it torn
+        spin_lock(&r->lock);
+        lw = r->lowat;
+        spin_unlock(&r->lock);
+        if (copy_to_user((void __user *)arg, &lw, sizeof(lw)))
+            return -EFAULT;
+        return 0;
+    }
+    default:
+        return -ENOTTY;
+    }
+}
+
+/*
+ * Always writable; readable once the file's queue reaches its low
+ * watermark. epoll waiters registered with EPOLLEXCLUSIVE are woken
+ * one at a time like blocked readers.
+ */
+__poll_t poll(struct file *filp, poll_table *wait)
+{
+    struct wait_reader *r = filp->private_data;
+    __poll_t mask = EPOLLOUT | EPOLLWRNORM;
+
+    poll_wait(filp, &r->wq, wait);
+    if (wait_reader_ready(r))
+        mask |= EPOLLIN | EPOLLRDNORM;
+    return mask;
 }
 
 /**
  * Declaration of the File operation for the device
  */
 struct file_operations fops = {
-    read:        read,
-    write:        write,
+    read_iter:   read_iter,
+    write_iter:  write_iter,
+    splice_read: wait_splice_read,
+    splice_write: iter_file_splice_write,
+    poll:        poll,
+    unlocked_ioctl: ioctl,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,5,0)
+    compat_ioctl: compat_ptr_ioctl,
+#endif
     open:         open,
     release:    release
 };
@@ -80,29 +585,32 @@ struct file_operations fops = {
 /**
  * Procfs Declartion
  */
-ssize_t write_proc(struct file *file,const char *buffer,size_t count,loff_t *data);
-ssize_t read_proc(struct file *file,char *buffer,size_t count,loff_t *data);
+ssize_t write_proc(struct file *file,const char __user *buffer,size_t count,loff_t *data);
+ssize_t read_proc(struct file *file,char __user *buffer,size_t count,loff_t *data);
 
+// procfs takes its own proc_ops since 5.6
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5,6,0)
+static const struct proc_ops fifo_fops = {
+       proc_read:    read_proc,
+       proc_write:  write_proc
+};
+#else
 struct file_operations fifo_fops = {
        read:    read_proc,
        write:  write_proc
 };
+#endif
 
-ssize_t read_proc(struct file *file,char *buffer,size_t count,loff_t *data)
+ssize_t read_proc(struct file *file,char __user *buffer,size_t count,loff_t *data)
 {
 	return 0;
 }
 
 
-ssize_t write_proc(struct file *file,const char *buffer,size_t count,loff_t *data)
+ssize_t write_proc(struct file *file,const char __user *buffer,size_t count,loff_t *data)
 {
-	int ret=0;
-	printk(KERN_INFO "procfile_write /proc/wait called\n");
-	ret = copy_from_user(char_arr.array, buffer, count);
-	printk(KERN_INFO "%s",buffer);
-	flag = 'y';
-	wake_up_interruptible(&queue);
-	return count;
+	evtrace("procfile_write /proc/wait called\n");
+	return wait_msg_post_user(buffer, count);
 }
 
 
@@ -134,16 +642,22 @@ int char_arr_init (void) {
     kernel_cdev->owner = THIS_MODULE;
     printk (" Inside init module\n");
 
+    if (event_log) {
+        ret = wait_log_init();
+        if (ret)
+            return ret;
+    }
+
 	//Dynamic allocation of the major number
      ret = alloc_chrdev_region( &dev_no , 0, 1,"chr_arr_dev");
     if (ret < 0) {
         printk("Major number allocation is failed\n");
+        vfree(wlog.slots);
         return ret;   
     }
    
     Major = MAJOR(dev_no);
     dev = MKDEV(Major,0);
-    sema_init(&char_arr.sem,1);   	//semaphore initialization
     printk (" The major number for your device is %d\n", Major);
 
     // Add the cdev structure
@@ -151,14 +665,14 @@ int char_arr_init (void) {
     if(ret < 0 )
     {
     printk(KERN_INFO "Unable to allocate cdev");
+    vfree(wlog.slots);
     return ret;
     }
 
-    led_class = class_create(THIS_MODULE, "TestingSysfsClass");
+    led_class = wait_class_create("TestingSysfsClass");
 
     device_create(led_class, NULL, dev, NULL, "led");
 
-    init_waitqueue_head(&queue);
     create_new_proc_entry();
     return 0;
 }
@@ -170,7 +684,10 @@ void char_arr_cleanup(void) {
     printk(KERN_INFO " Inside cleanup_module\n");
     proc_remove(Our_Proc_File);		//Remove the proc entry
     cdev_del(kernel_cdev);			//Delete the Cdev structure
-    unregister_chrdev_region(Major, 1);		//Unregister the device
+    device_destroy(led_class, MKDEV(Major, 0));
+    class_destroy(led_class);
+    unregister_chrdev_region(MKDEV(Major, 0), 1);	//Unregister the device
+    vfree(wlog.slots);
 }
 MODULE_LICENSE("GPL");   
 module_init(char_arr_init);
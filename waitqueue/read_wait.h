@@ -0,0 +1,31 @@
+/*
+ * read_wait.h -- ioctl interface of the read_wait /dev/led device
+ */
+
+#ifndef _READ_WAIT_H
+#define _READ_WAIT_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/*
+ * Per-open wakeup coalescing, along the lines of SO_RCVLOWAT. A blocked
+ * reader or poller is only woken once @events messages or @bytes bytes
+ * are pending, or @timeout_us after a message arrived without reaching
+ * either. A zero threshold is disabled; all zero wakes on every
+ * message. A full queue always wakes the reader. @events may not
+ * exceed the queue depth nor @bytes what a full queue can hold; @bytes
+ * is ignored in event-log mode.
+ */
+struct wait_lowat {
+	__u32 events;
+	__u32 bytes;
+	__u32 timeout_us;
+	__u32 __pad;
+};
+
+#define WAIT_IOC_MAGIC		'w'
+#define WAIT_IOC_SET_LOWAT	_IOW(WAIT_IOC_MAGIC, 1, struct wait_lowat)
+#define WAIT_IOC_GET_LOWAT	_IOR(WAIT_IOC_MAGIC, 2, struct wait_lowat)
+
+#endif /* _READ_WAIT_H */
@@ -0,0 +1,410 @@
+/*
+ * wait_bench.c -- wakeup latency and throughput benchmark for the char
+ * devices in this tree.
+ *
+ * Writer threads post fixed-size records stamped with CLOCK_MONOTONIC,
+ * reader threads sleep on the device and compute write-to-wakeup
+ * latency for every record they get back. At the end one result line
+ * is printed as CSV or JSON so runs can be compared over time.
+ *
+ *   wait mode   (default): write /proc/wait, read /dev/led (read_wait.ko).
+ *                          Every reader receives every record.
+ *   stream mode (-m stream): write and read the same ring (chardriver.ko).
+ *                          Records are consumed once, so use one reader
+ *                          per device, e.g. -d /dev/led%d with nr_devs=N.
+ *                          Writers append whole records with LED_IOC_BATCH
+ *                          so concurrent writers never interleave.
+ *
+ * "%d" in a device path is replaced by the thread index.
+ *
+ * Build: make bench
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "read_wait.h"
+#include "../chardriver/chardriver.h"
+
+#define MAX_CPUS	256
+#define MAX_SAMPLES	(1 << 20)	/* per reader */
+#define REC_MAGIC	0x57424e43u	/* "WBNC" */
+
+struct rec_hdr {
+	uint32_t magic;
+	uint32_t writer;
+	uint64_t seq;
+	uint64_t ts_ns;
+};
+
+static struct {
+	const char *rdev;
+	const char *wdev;
+	int stream;
+	int readers;
+	int writers;
+	size_t size;
+	long rate;		/* records per second per writer, 0 = flat out */
+	int duration;
+	int cpus[MAX_CPUS];
+	int ncpus;
+	int json;
+	unsigned int lowat_events;
+	unsigned int lowat_us;
+} cfg = {
+	.rdev = "/dev/led",
+	.wdev = "/proc/wait",
+	.readers = 1,
+	.writers = 1,
+	.size = 64,
+	.duration = 5,
+};
+
+static atomic_int stop;
+
+struct thread {
+	pthread_t tid;
+	int idx;
+	int cpu;
+	uint64_t records;
+	uint64_t bytes;
+	uint64_t errors;
+	uint64_t *lat;
+	size_t nlat;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void pin(int cpu)
+{
+	cpu_set_t set;
+
+	if (cpu < 0)
+		return;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set))
+		fprintf(stderr, "warning: cannot pin to cpu %d\n", cpu);
+}
+
+static int open_dev(const char *fmt, int idx, int flags)
+{
+	char path[256];
+	int fd;
+
+	snprintf(path, sizeof(path), fmt, idx);
+	fd = open(path, flags);
+	if (fd < 0)
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+	return fd;
+}
+
+static void *writer(void *arg)
+{
+	struct thread *t = arg;
+	char *buf = calloc(1, cfg.size);
+	struct rec_hdr *h = (struct rec_hdr *)buf;
+	uint64_t next = now_ns(), period = cfg.rate ? 1000000000ull / cfg.rate : 0;
+	int fd;
+
+	pin(t->cpu);
+	fd = open_dev(cfg.stream ? cfg.rdev : cfg.wdev, t->idx, O_WRONLY);
+	if (fd < 0 || !buf) {
+		t->errors++;
+		free(buf);
+		return NULL;
+	}
+
+	h->magic = REC_MAGIC;
+	h->writer = t->idx;
+	while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+		if (period) {
+			struct timespec ts;
+
+			next += period;
+			ts.tv_sec = next / 1000000000ull;
+			ts.tv_nsec = next % 1000000000ull;
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+		}
+		h->seq = t->records;
+		h->ts_ns = now_ns();
+		if (cfg.stream) {
+			struct led_batch_op op = {
+				.addr = (uintptr_t)buf,
+				.len = cfg.size,
+				.flags = LED_OP_WRITE,
+			};
+			struct led_batch b = { .ops = (uintptr_t)&op, .nr = 1 };
+
+			if (ioctl(fd, LED_IOC_BATCH, &b) != 1) {
+				if (op.result != -EAGAIN)
+					t->errors++;
+				continue;	/* ring full: drop, the rate is too high */
+			}
+		} else if (write(fd, buf, cfg.size) != (ssize_t)cfg.size) {
+			t->errors++;
+			continue;
+		}
+		t->records++;
+		t->bytes += cfg.size;
+	}
+	close(fd);
+	free(buf);
+	return NULL;
+}
+
+static void *reader(void *arg)
+{
+	struct thread *t = arg;
+	size_t cap = cfg.size * 64, fill = 0, off;
+	char *buf = malloc(cap);
+	struct pollfd pfd;
+	ssize_t n;
+
+	pin(t->cpu);
+	t->lat = malloc(MAX_SAMPLES * sizeof(*t->lat));
+	pfd.fd = open_dev(cfg.rdev, t->idx, O_RDONLY | O_NONBLOCK);
+	pfd.events = POLLIN;
+	if (pfd.fd < 0 || !buf || !t->lat) {
+		t->errors++;
+		free(buf);
+		return NULL;
+	}
+
+	if (!cfg.stream && (cfg.lowat_events || cfg.lowat_us)) {
+		struct wait_lowat lw = {
+			.events = cfg.lowat_events,
+			.timeout_us = cfg.lowat_us,
+		};
+
+		if (ioctl(pfd.fd, WAIT_IOC_SET_LOWAT, &lw))
+			fprintf(stderr, "WAIT_IOC_SET_LOWAT: %s\n", strerror(errno));
+	}
+
+	while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+		if (poll(&pfd, 1, 100) <= 0)
+			continue;
+		n = read(pfd.fd, buf + fill, cap - fill);
+		if (n < 0) {
+			if (errno != EAGAIN)
+				t->errors++;
+			continue;
+		}
+		uint64_t now = now_ns();
+
+		/* The devices may hand back several records, or part of one */
+		fill += n;
+		for (off = 0; off + cfg.size <= fill; off += cfg.size) {
+			struct rec_hdr h;
+
+			memcpy(&h, buf + off, sizeof(h));
+			if (h.magic != REC_MAGIC) {
+				t->errors++;
+				continue;
+			}
+			t->records++;
+			t->bytes += cfg.size;
+			if (t->nlat < MAX_SAMPLES)
+				t->lat[t->nlat++] = now - h.ts_ns;
+		}
+		memmove(buf, buf + off, fill - off);
+		fill -= off;
+	}
+	close(pfd.fd);
+	free(buf);
+	return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static uint64_t pct(const uint64_t *v, size_t n, double p)
+{
+	size_t i;
+
+	if (!n)
+		return 0;
+	i = (size_t)(p / 100.0 * (n - 1) + 0.5);
+	return v[i];
+}
+
+static int parse_cpus(const char *s)
+{
+	char *end;
+
+	while (*s && cfg.ncpus < MAX_CPUS) {
+		long a = strtol(s, &end, 10), b = a;
+
+		if (end == s)
+			return -1;
+		if (*end == '-')
+			b = strtol(end + 1, &end, 10);
+		for (; a <= b && cfg.ncpus < MAX_CPUS; a++)
+			cfg.cpus[cfg.ncpus++] = a;
+		s = *end == ',' ? end + 1 : end;
+	}
+	return 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  -m wait|stream  benchmark mode (default wait)\n"
+		"  -d PATH         device readers open (default /dev/led)\n"
+		"  -w PATH         file writers open in wait mode (default /proc/wait)\n"
+		"  -r N            reader threads (default 1)\n"
+		"  -p N            writer threads (default 1)\n"
+		"  -s BYTES        record size, at least %zu (default 64)\n"
+		"  -R RATE         records/s per writer, 0 = unthrottled (default 0)\n"
+		"  -t SECONDS      run time (default 5)\n"
+		"  -c CPUS         cpu list for pinning, e.g. 0-3,6; threads are\n"
+		"                  assigned round robin, readers first\n"
+		"  -l EVENTS       reader low watermark (WAIT_IOC_SET_LOWAT)\n"
+		"  -L USEC         reader coalescing timeout\n"
+		"  -j              print JSON instead of CSV\n",
+		prog, sizeof(struct rec_hdr));
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	struct thread *rd, *wr;
+	uint64_t wrecs = 0, rrecs = 0, rbytes = 0, errors = 0, *lat;
+	size_t nlat = 0, i;
+	double secs;
+	uint64_t t0;
+	int c, k;
+
+	while ((c = getopt(argc, argv, "m:d:w:r:p:s:R:t:c:l:L:jh")) != -1) {
+		switch (c) {
+		case 'm': cfg.stream = !strcmp(optarg, "stream"); break;
+		case 'd': cfg.rdev = optarg; break;
+		case 'w': cfg.wdev = optarg; break;
+		case 'r': cfg.readers = atoi(optarg); break;
+		case 'p': cfg.writers = atoi(optarg); break;
+		case 's': cfg.size = strtoul(optarg, NULL, 0); break;
+		case 'R': cfg.rate = atol(optarg); break;
+		case 't': cfg.duration = atoi(optarg); break;
+		case 'c': if (parse_cpus(optarg)) usage(argv[0]); break;
+		case 'l': cfg.lowat_events = strtoul(optarg, NULL, 0); break;
+		case 'L': cfg.lowat_us = strtoul(optarg, NULL, 0); break;
+		case 'j': cfg.json = 1; break;
+		default: usage(argv[0]);
+		}
+	}
+	if (cfg.size < sizeof(struct rec_hdr) || cfg.readers < 1 ||
+	    cfg.writers < 1 || cfg.duration < 1)
+		usage(argv[0]);
+
+	rd = calloc(cfg.readers, sizeof(*rd));
+	wr = calloc(cfg.writers, sizeof(*wr));
+	if (!rd || !wr)
+		return 1;
+
+	for (k = 0; k < cfg.readers + cfg.writers; k++) {
+		struct thread *t = k < cfg.readers ? &rd[k] : &wr[k - cfg.readers];
+
+		t->idx = k < cfg.readers ? k : k - cfg.readers;
+		t->cpu = cfg.ncpus ? cfg.cpus[k % cfg.ncpus] : -1;
+	}
+
+	/* Readers first, so nothing written is missed */
+	for (k = 0; k < cfg.readers; k++)
+		pthread_create(&rd[k].tid, NULL, reader, &rd[k]);
+	usleep(100000);
+	t0 = now_ns();
+	for (k = 0; k < cfg.writers; k++)
+		pthread_create(&wr[k].tid, NULL, writer, &wr[k]);
+
+	sleep(cfg.duration);
+	atomic_store(&stop, 1);
+	secs = (now_ns() - t0) / 1e9;
+
+	for (k = 0; k < cfg.writers; k++) {
+		pthread_join(wr[k].tid, NULL);
+		wrecs += wr[k].records;
+		errors += wr[k].errors;
+	}
+	for (k = 0; k < cfg.readers; k++) {
+		pthread_join(rd[k].tid, NULL);
+		rrecs += rd[k].records;
+		rbytes += rd[k].bytes;
+		errors += rd[k].errors;
+		nlat += rd[k].nlat;
+	}
+
+	lat = malloc((nlat ? nlat : 1) * sizeof(*lat));
+	if (!lat)
+		return 1;
+	for (k = 0, i = 0; k < cfg.readers; k++) {
+		memcpy(lat + i, rd[k].lat, rd[k].nlat * sizeof(*lat));
+		i += rd[k].nlat;
+		free(rd[k].lat);
+	}
+	qsort(lat, nlat, sizeof(*lat), cmp_u64);
+
+	if (cfg.json) {
+		printf("{\"mode\":\"%s\",\"readers\":%d,\"writers\":%d,"
+		       "\"msg_size\":%zu,\"rate\":%ld,\"seconds\":%.3f,"
+		       "\"written\":%llu,\"read\":%llu,\"errors\":%llu,"
+		       "\"msgs_per_s\":%.1f,\"mb_per_s\":%.3f,\"samples\":%zu,"
+		       "\"lat_p50_ns\":%llu,\"lat_p90_ns\":%llu,"
+		       "\"lat_p99_ns\":%llu,\"lat_p999_ns\":%llu,"
+		       "\"lat_max_ns\":%llu}\n",
+		       cfg.stream ? "stream" : "wait", cfg.readers, cfg.writers,
+		       cfg.size, cfg.rate, secs,
+		       (unsigned long long)wrecs, (unsigned long long)rrecs,
+		       (unsigned long long)errors, rrecs / secs,
+		       rbytes / secs / 1e6, nlat,
+		       (unsigned long long)pct(lat, nlat, 50),
+		       (unsigned long long)pct(lat, nlat, 90),
+		       (unsigned long long)pct(lat, nlat, 99),
+		       (unsigned long long)pct(lat, nlat, 99.9),
+		       (unsigned long long)(nlat ? lat[nlat - 1] : 0));
+	} else {
+		printf("mode,readers,writers,msg_size,rate,seconds,written,read,"
+		       "errors,msgs_per_s,mb_per_s,samples,lat_p50_ns,"
+		       "lat_p90_ns,lat_p99_ns,lat_p999_ns,lat_max_ns\n");
+		printf("%s,%d,%d,%zu,%ld,%.3f,%llu,%llu,%llu,%.1f,%.3f,%zu,"
+		       "%llu,%llu,%llu,%llu,%llu\n",
+		       cfg.stream ? "stream" : "wait", cfg.readers, cfg.writers,
+		       cfg.size, cfg.rate, secs,
+		       (unsigned long long)wrecs, (unsigned long long)rrecs,
+		       (unsigned long long)errors, rrecs / secs,
+		       rbytes / secs / 1e6, nlat,
+		       (unsigned long long)pct(lat, nlat, 50),
+		       (unsigned long long)pct(lat, nlat, 90),
+		       (unsigned long long)pct(lat, nlat, 99),
+		       (unsigned long long)pct(lat, nlat, 99.9),
+		       (unsigned long long)(nlat ? lat[nlat - 1] : 0));
+	}
+
+	free(lat);
+	free(rd);
+	free(wr);
+	return errors ? 1 : 0;
+}